@@ -0,0 +1,119 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Crc32c_p.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <nmmintrin.h>
+    #define ARCUS_CRC32C_SSE42 __attribute__((target("sse4.2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <nmmintrin.h>
+    #include <intrin.h>
+    #define ARCUS_CRC32C_SSE42
+#endif
+
+using namespace Arcus::Private;
+
+namespace
+{
+    // Reversed representation of the Castagnoli polynomial.
+    const uint32_t castagnoli_polynomial = 0x82f63b78;
+
+    struct Crc32cTable
+    {
+        Crc32cTable()
+        {
+            for(uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t value = i;
+                for(int bit = 0; bit < 8; ++bit)
+                {
+                    value = (value >> 1) ^ ((value & 1) ? castagnoli_polynomial : 0);
+                }
+                entries[i] = value;
+            }
+        }
+
+        uint32_t entries[256];
+    };
+
+    uint32_t crc32cSoftware(const unsigned char* data, std::size_t size, uint32_t crc)
+    {
+        static const Crc32cTable table;
+        for(std::size_t i = 0; i < size; ++i)
+        {
+            crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#ifdef ARCUS_CRC32C_SSE42
+    bool hasSse42()
+    {
+    #ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+    #else
+        return __builtin_cpu_supports("sse4.2");
+    #endif
+    }
+
+    ARCUS_CRC32C_SSE42 uint32_t crc32cSse42(const unsigned char* data, std::size_t size, uint32_t crc)
+    {
+    #if defined(__x86_64__) || defined(_M_X64)
+        uint64_t crc64 = crc;
+        for(; size >= 8; size -= 8, data += 8)
+        {
+            uint64_t value;
+            std::memcpy(&value, data, sizeof(value));
+            crc64 = _mm_crc32_u64(crc64, value);
+        }
+        crc = static_cast<uint32_t>(crc64);
+    #endif
+        for(; size >= 4; size -= 4, data += 4)
+        {
+            uint32_t value;
+            std::memcpy(&value, data, sizeof(value));
+            crc = _mm_crc32_u32(crc, value);
+        }
+        for(; size > 0; --size, ++data)
+        {
+            crc = _mm_crc32_u8(crc, *data);
+        }
+        return crc;
+    }
+#endif
+}
+
+uint32_t Arcus::Private::crc32c(const char* data, std::size_t size, uint32_t crc)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+
+#ifdef ARCUS_CRC32C_SSE42
+    static const bool use_sse42 = hasSse42();
+    if(use_sse42)
+    {
+        return ~crc32cSse42(bytes, size, ~crc);
+    }
+#endif
+
+    return ~crc32cSoftware(bytes, size, ~crc);
+}
@@ -0,0 +1,45 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCUS_CRC32C_P_H
+#define ARCUS_CRC32C_P_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Arcus
+{
+    namespace Private
+    {
+        /**
+         * Calculate the CRC32C (Castagnoli) checksum of a block of data.
+         *
+         * Uses the CRC32 instructions of the processor when available.
+         *
+         * \param data The data to calculate the checksum of.
+         * \param size The size of the data in bytes.
+         * \param crc The checksum of the data preceding this block, to calculate
+         * the checksum of data that is received in several parts.
+         *
+         * \return The checksum of the preceding data followed by this block.
+         */
+        uint32_t crc32c(const char* data, std::size_t size, uint32_t crc = 0);
+    }
+}
+
+#endif //ARCUS_CRC32C_P_H
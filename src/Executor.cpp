@@ -0,0 +1,161 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Executor_p.h"
+
+#include <algorithm>
+#include <thread>
+
+using namespace Arcus::Private;
+
+namespace
+{
+    // The pool and index of the worker the current thread is, if any.
+    thread_local Executor* current_executor = nullptr;
+    thread_local std::size_t current_worker = 0;
+}
+
+Executor::Executor()
+    : thread_count(0)
+    , started(false)
+    , next_worker(0)
+    , queued(0)
+    , sleeping(0)
+{
+}
+
+Executor& Executor::getInstance()
+{
+    // Never destroyed, so tasks still running while the process exits do not use a destroyed pool.
+    static Executor* instance = new Executor();
+    return *instance;
+}
+
+void Executor::setThreadCount(int count)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    thread_count = std::max(count, 0);
+}
+
+int Executor::getThreadCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return thread_count > 0 ? thread_count : std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+}
+
+void Executor::post(std::function<void()> task)
+{
+    if(!started)
+    {
+        start();
+    }
+
+    const std::size_t index = current_executor == this ? current_worker : next_worker++ % workers.size();
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+
+    // A thread that is about to wait sees the task, or is waiting and gets woken up.
+    ++queued;
+    if(sleeping > 0)
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        sleep_condition_variable.notify_one();
+    }
+}
+
+void Executor::start()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(started)
+    {
+        return;
+    }
+
+    const int count = thread_count > 0 ? thread_count : std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    for(int i = 0; i < count; ++i)
+    {
+        workers.emplace_back(new Worker());
+    }
+    for(int i = 0; i < count; ++i)
+    {
+        std::thread(&Executor::work, this, i).detach();
+    }
+    started = true;
+}
+
+void Executor::work(std::size_t index)
+{
+    current_executor = this;
+    current_worker = index;
+
+    std::function<void()> task;
+    while(true)
+    {
+        if(take(index, task))
+        {
+            try
+            {
+                task();
+            }
+            catch(...)
+            {
+                // An exception leaving a task would end the process, so the pool keeps running instead.
+            }
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        ++sleeping;
+        sleep_condition_variable.wait(lock, [this]() { return queued > 0; });
+        --sleeping;
+    }
+}
+
+bool Executor::take(std::size_t index, std::function<void()>& task)
+{
+    {
+        Worker& worker = *workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if(!worker.tasks.empty())
+        {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+            --queued;
+            return true;
+        }
+    }
+
+    // Steal the oldest task of another thread.
+    for(std::size_t i = 1; i < workers.size(); ++i)
+    {
+        Worker& victim = *workers[(index + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --queued;
+            return true;
+        }
+    }
+
+    return false;
+}
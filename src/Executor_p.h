@@ -0,0 +1,106 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCUS_EXECUTOR_P_H
+#define ARCUS_EXECUTOR_P_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Arcus
+{
+    namespace Private
+    {
+        /**
+         * Private class that runs tasks on a pool of threads shared by all sockets in the process.
+         *
+         * Each thread has its own queue of tasks. Tasks posted by a thread of the pool go to the queue
+         * of that thread, so follow-up work stays where its data is. Other tasks are spread over the
+         * queues. A thread whose queue is empty steals the oldest task of another thread, so threads
+         * that run out of work help the others when some tasks take much longer than the rest.
+         *
+         * The threads are started when the first task is posted and run until the process exits.
+         */
+        class Executor
+        {
+        public:
+            /**
+             * Get the pool shared by all sockets in the process.
+             */
+            static Executor& getInstance();
+
+            /**
+             * Set the amount of threads of the pool.
+             *
+             * This only has an effect before the first task is posted.
+             *
+             * \param count The amount of threads, or 0 for one per processor.
+             */
+            void setThreadCount(int count);
+            /**
+             * Get the amount of threads of the pool.
+             */
+            int getThreadCount() const;
+
+            /**
+             * Run a task on one of the threads of the pool.
+             */
+            void post(std::function<void()> task);
+
+        private:
+            /**
+             * The queue of tasks of one thread of the pool.
+             */
+            struct Worker
+            {
+                std::mutex mutex;
+                std::deque<std::function<void()>> tasks;
+            };
+
+            Executor();
+
+            // Start the threads of the pool, if that has not happened yet.
+            void start();
+            // Take and run tasks, waiting for more when there are none left.
+            void work(std::size_t index);
+            // Take a task from the queue of a thread, or steal one from another thread.
+            bool take(std::size_t index, std::function<void()>& task);
+
+            mutable std::mutex mutex;
+            int thread_count;
+            // Set once the threads have been started, after which workers does not change.
+            std::atomic<bool> started;
+            std::vector<std::unique_ptr<Worker>> workers;
+            // Queue the next task posted from outside the pool goes to.
+            std::atomic<std::size_t> next_worker;
+
+            // Amount of tasks in all queues, and threads waiting for tasks.
+            std::atomic<std::size_t> queued;
+            std::atomic<int> sleeping;
+            std::mutex sleep_mutex;
+            std::condition_variable sleep_condition_variable;
+        };
+    }
+}
+
+#endif //ARCUS_EXECUTOR_P_H
@@ -0,0 +1,169 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MemoryBudget_p.h"
+
+#include <chrono>
+
+using namespace Arcus::Private;
+
+MemoryBudget::Account::Account()
+    : limit(0)
+    , used(0)
+{
+}
+
+MemoryBudget::Account::~Account()
+{
+    MemoryBudget::getInstance().release(*this, used);
+}
+
+void MemoryBudget::Account::setLimit(uint64_t maximum)
+{
+    limit = maximum;
+}
+
+uint64_t MemoryBudget::Account::getUsed() const
+{
+    return used;
+}
+
+MemoryBudget::MemoryBudget()
+    : total_limit(0)
+    , total_used(0)
+    , active_accounts(0)
+{
+}
+
+MemoryBudget& MemoryBudget::getInstance()
+{
+    static MemoryBudget instance;
+    return instance;
+}
+
+void MemoryBudget::setTotalLimit(uint64_t maximum)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    total_limit = maximum;
+    condition_variable.notify_all();
+}
+
+uint64_t MemoryBudget::getTotalLimit() const
+{
+    return total_limit;
+}
+
+bool MemoryBudget::fits(const Account& account, uint64_t size) const
+{
+    return (account.limit == 0 || size <= account.limit) && (total_limit == 0 || size <= total_limit);
+}
+
+bool MemoryBudget::isAvailable(const Account& account, uint64_t size) const
+{
+    if(total_limit == 0)
+    {
+        return account.limit == 0 || account.used + size <= account.limit;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return isAvailableLocked(account, size);
+}
+
+bool MemoryBudget::reserve(Account& account, uint64_t size, int timeout)
+{
+    if(account.limit == 0 && total_limit == 0)
+    {
+        add(account, size);
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if(!condition_variable.wait_for(lock, std::chrono::milliseconds(timeout), [&]() { return isAvailableLocked(account, size); }))
+    {
+        return false;
+    }
+
+    add(account, size);
+    return true;
+}
+
+void MemoryBudget::add(Account& account, uint64_t size)
+{
+    if(size == 0)
+    {
+        return;
+    }
+
+    if(account.used.fetch_add(size) == 0)
+    {
+        ++active_accounts;
+    }
+    total_used += size;
+}
+
+void MemoryBudget::release(Account& account, uint64_t size)
+{
+    if(size == 0)
+    {
+        return;
+    }
+
+    if(account.used.fetch_sub(size) == size)
+    {
+        --active_accounts;
+    }
+    total_used -= size;
+
+    // Wake up sockets waiting for memory. Locking makes sure a socket that is about to wait does not miss this.
+    if(account.limit > 0 || total_limit > 0)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        condition_variable.notify_all();
+    }
+}
+
+bool MemoryBudget::isAvailableLocked(const Account& account, uint64_t size) const
+{
+    const uint64_t used = account.used;
+    if(account.limit > 0 && used + size > account.limit)
+    {
+        return false;
+    }
+
+    const uint64_t total = total_limit;
+    if(total == 0)
+    {
+        return true;
+    }
+
+    const uint64_t total_in_use = total_used;
+    if(total_in_use + size > total)
+    {
+        return false;
+    }
+
+    // The last quarter of the total is only used by sockets that stay within an equal share of it.
+    // The share leaves room for one more socket, so a single busy socket cannot take all of it.
+    if(total_in_use + size <= total - total / 4)
+    {
+        return true;
+    }
+
+    const uint32_t others = active_accounts - (used > 0 ? 1 : 0);
+    return used + size <= total / (others + 2);
+}
@@ -0,0 +1,136 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCUS_MEMORY_BUDGET_P_H
+#define ARCUS_MEMORY_BUDGET_P_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace Arcus
+{
+    namespace Private
+    {
+        /**
+         * Private class that limits the memory used by data received by sockets.
+         *
+         * Each socket accounts for the messages it is receiving and the received messages waiting in its
+         * queue. A socket can have its own limit, and all sockets in the process can share a total limit.
+         * When most of the total is in use, sockets using more than an equal share of it have to wait,
+         * so the remainder stays available to the others.
+         */
+        class MemoryBudget
+        {
+        public:
+            /**
+             * The memory used by a single socket.
+             */
+            class Account
+            {
+            public:
+                Account();
+                ~Account();
+
+                Account(const Account&) = delete;
+                Account& operator=(const Account&) = delete;
+
+                /**
+                 * Set the maximum amount of memory of the account.
+                 *
+                 * \param maximum The maximum in bytes, or 0 for no limit.
+                 */
+                void setLimit(uint64_t maximum);
+
+                /**
+                 * Get the amount of memory in use by the account.
+                 */
+                uint64_t getUsed() const;
+
+            private:
+                friend class MemoryBudget;
+
+                std::atomic<uint64_t> limit;
+                std::atomic<uint64_t> used;
+            };
+
+            /**
+             * Get the budget shared by all sockets in the process.
+             */
+            static MemoryBudget& getInstance();
+
+            /**
+             * Set the total amount of memory all sockets in the process may use for received data.
+             *
+             * \param maximum The maximum in bytes, or 0 for no limit.
+             */
+            void setTotalLimit(uint64_t maximum);
+            /**
+             * Get the total amount of memory all sockets in the process may use, or 0 if there is no limit.
+             */
+            uint64_t getTotalLimit() const;
+
+            /**
+             * Can an amount of memory ever be reserved by an account, given the current limits?
+             */
+            bool fits(const Account& account, uint64_t size) const;
+
+            /**
+             * Can an amount of memory be reserved by an account right now?
+             */
+            bool isAvailable(const Account& account, uint64_t size) const;
+
+            /**
+             * Wait until an amount of memory is available to an account, and account for it.
+             *
+             * \param account The account of the socket that wants to use the memory.
+             * \param size The amount of bytes to reserve.
+             * \param timeout The maximum time in milliseconds to wait.
+             * \return True if the memory was reserved, false if it was not available in time.
+             */
+            bool reserve(Account& account, uint64_t size, int timeout);
+
+            /**
+             * Account for memory without checking the limits, for data that has already been admitted.
+             */
+            void add(Account& account, uint64_t size);
+
+            /**
+             * Return memory that is no longer in use.
+             */
+            void release(Account& account, uint64_t size);
+
+        private:
+            MemoryBudget();
+
+            // Does the reservation fit the limits? Called with the mutex locked when the total is limited.
+            bool isAvailableLocked(const Account& account, uint64_t size) const;
+
+            std::atomic<uint64_t> total_limit;
+            std::atomic<uint64_t> total_used;
+            // Amount of accounts that use any memory, which determines the equal share of each.
+            std::atomic<uint32_t> active_accounts;
+
+            mutable std::mutex mutex;
+            std::condition_variable condition_variable;
+        };
+    }
+}
+
+#endif //ARCUS_MEMORY_BUDGET_P_H
@@ -0,0 +1,58 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCUS_MESSAGEHANDLER_H
+#define ARCUS_MESSAGEHANDLER_H
+
+#include "Types.h"
+
+#include "ArcusExport.h"
+
+namespace Arcus
+{
+    class Socket;
+
+    /**
+     * Interface for objects that handle received messages on a thread pool.
+     *
+     * When a handler is set with Socket::setMessageHandler(), received messages are
+     * passed to it instead of being put on the receive queue. Messages with the same
+     * key, see Socket::setMessageKeyField(), are handled one after the other in the
+     * order they were received. Messages with different keys are handled at the same
+     * time by the threads of the pool.
+     */
+    class ARCUS_EXPORT MessageHandler
+    {
+    public:
+        MessageHandler() { }
+        virtual ~MessageHandler() { }
+
+        /**
+         * Called from a thread of the pool to handle a received message.
+         *
+         * The socket waits for its messages to be handled when it is destroyed, so this must
+         * not destroy the socket. Exceptions are caught and reported as errors of the socket.
+         *
+         * \param socket The socket the message was received by.
+         * \param message The received message.
+         */
+        virtual void handleMessage(Socket* socket, MessagePtr message) = 0;
+    };
+}
+
+#endif // ARCUS_MESSAGEHANDLER_H
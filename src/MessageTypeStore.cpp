@@ -19,8 +19,12 @@
 #include "MessageTypeStore.h"
 
 #include <unordered_map>
+#include <atomic>
+#include <mutex>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <thread>
 
 #include <google/protobuf/dynamic_message.h>
 #include <google/protobuf/compiler/importer.h>
@@ -76,8 +80,73 @@ private:
 class ARCUS_NO_EXPORT MessageTypeStore::Private
 {
 public:
-    std::unordered_map<uint, const google::protobuf::Message*> message_types;
-    std::unordered_map<const google::protobuf::Descriptor*, uint> message_type_mapping;
+    /**
+     * The registered message types. A table is never changed once it is in use, registering
+     * types replaces it with a copy that includes them.
+     */
+    struct TypeTable
+    {
+        std::unordered_map<uint, const google::protobuf::Message*> message_types;
+        std::unordered_map<const google::protobuf::Descriptor*, uint> message_type_mapping;
+    };
+
+    /**
+     * The current table, read for the duration of a lookup.
+     *
+     * While a snapshot exists, the table it was taken from is not deleted.
+     */
+    class TableSnapshot
+    {
+    public:
+        TableSnapshot(const Private& d)
+            : d(d)
+        {
+            ++d.table_readers;
+            table = d.table.load();
+        }
+
+        ~TableSnapshot()
+        {
+            --d.table_readers;
+        }
+
+        const TypeTable* operator->() const { return table; }
+
+    private:
+        const Private& d;
+        const TypeTable* table;
+    };
+
+    Private()
+        : table(new TypeTable())
+        , table_readers(0)
+    {
+    }
+
+    ~Private()
+    {
+        delete table.load();
+    }
+
+    // Make a new table the current one and delete the replaced one once no lookup uses it. Called with registration_mutex locked.
+    void publish(const TypeTable* new_table)
+    {
+        const TypeTable* replaced = table.exchange(new_table);
+
+        // Lookups that start from now on use the new table, and lookups do not wait for anything.
+        while(table_readers > 0)
+        {
+            std::this_thread::yield();
+        }
+        delete replaced;
+    }
+
+    // The current table, which is read without locking.
+    std::atomic<const TypeTable*> table;
+    // Amount of lookups in progress, which may be using a replaced table.
+    mutable std::atomic<int> table_readers;
+    // Guards registering types, so they are not lost when registered at the same time.
+    std::mutex registration_mutex;
 
     std::shared_ptr<ErrorCollector> error_collector;
     std::shared_ptr<google::protobuf::compiler::DiskSourceTree> source_tree;
@@ -95,7 +164,8 @@ Arcus::MessageTypeStore::~MessageTypeStore()
 
 bool Arcus::MessageTypeStore::hasType(uint32_t type_id) const
 {
-    if(d->message_types.find(type_id) != d->message_types.end())
+    Private::TableSnapshot table(*d);
+    if(table->message_types.find(type_id) != table->message_types.end())
     {
         return true;
     }
@@ -111,12 +181,14 @@ bool Arcus::MessageTypeStore::hasType(const std::string& type_name) const
 
 MessagePtr Arcus::MessageTypeStore::createMessage(uint32_t type_id) const
 {
-    if(!hasType(type_id))
+    Private::TableSnapshot table(*d);
+    auto message_type = table->message_types.find(type_id);
+    if(message_type == table->message_types.end())
     {
         return MessagePtr();
     }
 
-    return MessagePtr(d->message_types[type_id]->New());
+    return MessagePtr(message_type->second->New());
 }
 
 MessagePtr Arcus::MessageTypeStore::createMessage(const std::string& type_name) const
@@ -130,28 +202,46 @@ uint32_t Arcus::MessageTypeStore::getMessageTypeId(const MessagePtr& message)
     return hash(message->GetTypeName());
 }
 
+std::vector<uint32_t> Arcus::MessageTypeStore::getMessageTypeIds() const
+{
+    Private::TableSnapshot table(*d);
+    std::vector<uint32_t> result;
+    result.reserve(table->message_types.size());
+    for(auto type : table->message_types)
+    {
+        result.push_back(type.first);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
 std::string Arcus::MessageTypeStore::getErrorMessages() const
 {
-    return d->error_collector->getAllErrors();
+    std::lock_guard<std::mutex> lock(d->registration_mutex);
+    return d->error_collector ? d->error_collector->getAllErrors() : std::string();
 }
 
 bool Arcus::MessageTypeStore::registerMessageType(const google::protobuf::Message* message_type)
 {
     uint32_t type_id = hash(message_type->GetTypeName());
 
+    std::lock_guard<std::mutex> lock(d->registration_mutex);
     if(hasType(type_id))
     {
         return false;
     }
 
-    d->message_types[type_id] = message_type;
-    d->message_type_mapping[message_type->GetDescriptor()] = type_id;
+    auto table = new Private::TypeTable(*d->table.load());
+    table->message_types[type_id] = message_type;
+    table->message_type_mapping[message_type->GetDescriptor()] = type_id;
+    d->publish(table);
 
     return true;
 }
 
 bool Arcus::MessageTypeStore::registerAllMessageTypes(const std::string& file_name)
 {
+    std::lock_guard<std::mutex> lock(d->registration_mutex);
     if(!d->importer)
     {
         d->error_collector = std::make_shared<ErrorCollector>();
@@ -183,6 +273,7 @@ bool Arcus::MessageTypeStore::registerAllMessageTypes(const std::string& file_na
         d->message_factory = std::make_shared<google::protobuf::DynamicMessageFactory>();
     }
 
+    auto table = new Private::TypeTable(*d->table.load());
     for(int i = 0; i < descriptor->message_type_count(); ++i)
     {
         auto message_type_descriptor = descriptor->message_type(i);
@@ -191,16 +282,18 @@ bool Arcus::MessageTypeStore::registerAllMessageTypes(const std::string& file_na
 
         uint32_t type_id = hash(message_type->GetTypeName());
 
-        d->message_types[type_id] = message_type;
-        d->message_type_mapping[message_type_descriptor] = type_id;
+        table->message_types[type_id] = message_type;
+        table->message_type_mapping[message_type_descriptor] = type_id;
     }
+    d->publish(table);
 
     return true;
 }
 
 void Arcus::MessageTypeStore::dumpMessageTypes()
 {
-    for(auto type : d->message_types)
+    Private::TableSnapshot table(*d);
+    for(auto type : table->message_types)
     {
         std::cout << "Type ID: " << type.first << " Type Name: " << type.second->GetTypeName() << std::endl;
     }
@@ -20,6 +20,7 @@
 #define ARCUS_MESSAGE_TYPE_STORE_H
 
 #include <memory>
+#include <vector>
 
 #include "ArcusExport.h"
 #include "Types.h"
@@ -28,6 +29,9 @@ namespace Arcus
 {
     /**
      * A class to manage the different types of messages that are available.
+     *
+     * Types can be registered while other threads look them up. Lookups do not lock,
+     * they use a snapshot of the registered types that registration replaces.
      */
     class ARCUS_EXPORT MessageTypeStore
     {
@@ -78,6 +82,13 @@ namespace Arcus
          */
         uint32_t getMessageTypeId(const MessagePtr& message);
 
+        /**
+         * Get the type IDs of all registered message types.
+         *
+         * \return The type IDs, in ascending order.
+         */
+        std::vector<uint32_t> getMessageTypeIds() const;
+
         std::string getErrorMessages() const;
 
         /**
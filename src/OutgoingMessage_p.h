@@ -0,0 +1,75 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCUS_OUTGOING_MESSAGE_P_H
+#define ARCUS_OUTGOING_MESSAGE_P_H
+
+#include <atomic>
+#include <chrono>
+
+#include "Types.h"
+
+namespace Arcus
+{
+    namespace Private
+    {
+        /**
+         * Private class that encapsulates a message waiting in or taken from the send queue.
+         *
+         * Instances are shared between the socket and any SendHandle referring to the message,
+         * so all state that can change after queueing is atomic.
+         */
+        class OutgoingMessage
+        {
+        public:
+            OutgoingMessage(const MessagePtr& message, MessagePriority::MessagePriority priority, int time_to_live)
+                : message(message)
+                , priority(priority)
+                , deadline(time_to_live > 0 ? std::chrono::steady_clock::now() + std::chrono::milliseconds(time_to_live) : std::chrono::steady_clock::time_point())
+                , status(SendStatus::Queued)
+                , chunked(false)
+            {
+            }
+
+            // The message to send.
+            MessagePtr message;
+            // The priority class of the message.
+            const MessagePriority::MessagePriority priority;
+            // After this point in time the message is no longer sent, if set.
+            const std::chrono::steady_clock::time_point deadline;
+            // Current status of the message.
+            std::atomic<SendStatus::SendStatus> status;
+            // Is the message being sent as a chunked frame, so it can still be aborted while sending?
+            std::atomic<bool> chunked;
+
+            // Check if the message has a deadline that has passed.
+            inline bool hasExpired(std::chrono::steady_clock::time_point now) const
+            {
+                return deadline != std::chrono::steady_clock::time_point() && now > deadline;
+            }
+
+            // Change the status of the message, but only if the current status is from.
+            inline bool changeStatus(SendStatus::SendStatus from, SendStatus::SendStatus to)
+            {
+                return status.compare_exchange_strong(from, to);
+            }
+        };
+    }
+}
+
+#endif //ARCUS_OUTGOING_MESSAGE_P_H
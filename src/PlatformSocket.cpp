@@ -18,6 +18,13 @@
 
 #include "PlatformSocket_p.h"
 
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+
 #ifdef _WIN32
     #include <winsock2.h>
     #include <ws2tcpip.h>
@@ -26,10 +33,14 @@
     #include <sys/socket.h>
     #include <sys/time.h>
     #include <netinet/in.h>
+    #include <netinet/tcp.h>
     #include <arpa/inet.h>
+    #include <netdb.h>
     #include <unistd.h>
     #include <signal.h>
     #include <errno.h>
+    #include <poll.h>
+    #include <fcntl.h>
 #endif
 
 #ifndef MSG_NOSIGNAL
@@ -56,21 +67,266 @@ void initializeWSA()
 }
 #endif
 
-// Create a sockaddr_in structure from an address and port.
-sockaddr_in createAddress(const std::string& address, int port)
-{
-    sockaddr_in a;
-    a.sin_family = AF_INET;
 #ifdef _WIN32
-    InetPton(AF_INET, address.c_str(), &(a.sin_addr)); //Note: Vista and higher only.
+    typedef WSAPOLLFD PollEntry;
+    #define POLL_WRITABLE POLLWRNORM
+    #define pollSockets ::WSAPoll
 #else
-    ::inet_pton(AF_INET, address.c_str(), &(a.sin_addr));
+    typedef pollfd PollEntry;
+    #define POLL_WRITABLE POLLOUT
+    #define pollSockets ::poll
 #endif
-    a.sin_port = htons(port);
-    return a;
+
+namespace
+{
+    // An address resolved for a host name and port.
+    struct ResolvedAddress
+    {
+        sockaddr_storage address;
+        socklen_t size;
+        int family;
+    };
+
+    // Cached results of resolving host names, by host name, port and purpose.
+    struct AddressCacheEntry
+    {
+        std::vector<ResolvedAddress> addresses;
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    std::mutex address_cache_mutex;
+    std::unordered_map<std::string, AddressCacheEntry> address_cache;
+
+    // How long resolved addresses are cached.
+    const std::chrono::seconds address_cache_time(60);
+
+    // Delay before trying the next address when connecting to a host with several addresses.
+    const int connection_attempt_delay = 250;
+
+    // How often in milliseconds a connection attempt checks whether it was aborted.
+    const int abort_check_interval = 50;
+
+    void setLastError(int error)
+    {
+    #ifdef _WIN32
+        WSASetLastError(error);
+    #else
+        errno = error;
+    #endif
+    }
+
+    int getLastError()
+    {
+    #ifdef _WIN32
+        return WSAGetLastError();
+    #else
+        return errno;
+    #endif
+    }
+
+    void closeSocket(int socket_id)
+    {
+    #ifdef _WIN32
+        ::closesocket(socket_id);
+    #else
+        ::close(socket_id);
+    #endif
+    }
+
+    // Resolve a host name or IPv4 or IPv6 address, using the cache when possible.
+    //
+    // Addresses are ordered with alternating address families, starting with the family
+    // preferred by the system, so connection attempts quickly cover both families.
+    bool resolveAddress(const std::string& address, int port, bool passive, std::vector<ResolvedAddress>& result)
+    {
+        const std::string key = address + "/" + std::to_string(port) + (passive ? "/passive" : "");
+        const auto now = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(address_cache_mutex);
+            auto entry = address_cache.find(key);
+            if(entry != address_cache.end() && entry->second.expiry > now)
+            {
+                result = entry->second.addresses;
+                return true;
+            }
+        }
+
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+        hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+        addrinfo* info = nullptr;
+        int error = ::getaddrinfo(address.empty() ? nullptr : address.c_str(), std::to_string(port).c_str(), &hints, &info);
+        if(error != 0 || !info)
+        {
+            return false;
+        }
+
+        std::vector<ResolvedAddress> first_family;
+        std::vector<ResolvedAddress> other_families;
+        for(addrinfo* current = info; current; current = current->ai_next)
+        {
+            if(current->ai_addrlen > sizeof(sockaddr_storage))
+            {
+                continue;
+            }
+
+            ResolvedAddress resolved;
+            std::memset(&resolved.address, 0, sizeof(resolved.address));
+            std::memcpy(&resolved.address, current->ai_addr, current->ai_addrlen);
+            resolved.size = static_cast<socklen_t>(current->ai_addrlen);
+            resolved.family = current->ai_family;
+            (resolved.family == info->ai_family ? first_family : other_families).push_back(resolved);
+        }
+        ::freeaddrinfo(info);
+
+        result.clear();
+        for(std::size_t i = 0; i < std::max(first_family.size(), other_families.size()); ++i)
+        {
+            if(i < first_family.size())
+            {
+                result.push_back(first_family[i]);
+            }
+            if(i < other_families.size())
+            {
+                result.push_back(other_families[i]);
+            }
+        }
+
+        if(result.empty())
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(address_cache_mutex);
+        AddressCacheEntry& entry = address_cache[key];
+        entry.addresses = result;
+        entry.expiry = now + address_cache_time;
+        return true;
+    }
+
+    // Switch a socket between blocking and non-blocking mode.
+    bool setBlocking(int socket_id, bool blocking)
+    {
+    #ifdef _WIN32
+        u_long mode = blocking ? 0 : 1;
+        return ::ioctlsocket(socket_id, FIONBIO, &mode) == 0;
+    #else
+        int flags = ::fcntl(socket_id, F_GETFL, 0);
+        if(flags == -1)
+        {
+            return false;
+        }
+        flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+        return ::fcntl(socket_id, F_SETFL, flags) == 0;
+    #endif
+    }
+
+    // Set an integer socket option.
+    bool setSocketOption(int socket_id, int level, int option, int value)
+    {
+        return ::setsockopt(socket_id, level, option, reinterpret_cast<const char*>(&value), sizeof(value)) == 0;
+    }
+
+    // Set the buffer sizes of a socket. They affect the window size a connection negotiates, so set them before connecting.
+    bool setBufferSizes(int socket_id, const Arcus::SocketOptions& options)
+    {
+        bool result = true;
+        if(options.send_buffer_size > 0)
+        {
+            result &= setSocketOption(socket_id, SOL_SOCKET, SO_SNDBUF, options.send_buffer_size);
+        }
+        if(options.receive_buffer_size > 0)
+        {
+            result &= setSocketOption(socket_id, SOL_SOCKET, SO_RCVBUF, options.receive_buffer_size);
+        }
+        return result;
+    }
+
+    // Start a non-blocking connection attempt to an address.
+    //
+    // Returns the socket of the attempt, or -1 if the attempt failed immediately.
+    int startConnection(const ResolvedAddress& address, const Arcus::SocketOptions& options, bool fast_open)
+    {
+        int socket_id = ::socket(address.family, SOCK_STREAM, IPPROTO_TCP);
+        if(socket_id == -1)
+        {
+            return -1;
+        }
+
+        setBufferSizes(socket_id, options);
+
+    #ifdef TCP_FASTOPEN_CONNECT
+        if(fast_open)
+        {
+            int enable = 1;
+            ::setsockopt(socket_id, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, reinterpret_cast<const char*>(&enable), sizeof(enable));
+        }
+    #else
+        fast_open = false;
+    #endif
+
+        if(!setBlocking(socket_id, false))
+        {
+            closeSocket(socket_id);
+            return -1;
+        }
+
+        int result = ::connect(socket_id, reinterpret_cast<const sockaddr*>(&address.address), address.size);
+        if(result == 0 && fast_open)
+        {
+            // With fast open, the connection is only established when the first data is sent. Send a
+            // keepalive, which the peer ignores, so a failed connection is reported here instead of
+            // when sending the first message.
+            uint32_t keepalive = 0;
+            result = ::send(socket_id, reinterpret_cast<const char*>(&keepalive), sizeof(keepalive), MSG_NOSIGNAL);
+        }
+
+        if(result < 0)
+        {
+        #ifdef _WIN32
+            bool in_progress = WSAGetLastError() == WSAEWOULDBLOCK;
+        #else
+            bool in_progress = errno == EINPROGRESS || errno == EAGAIN;
+        #endif
+            if(!in_progress)
+            {
+                int error = getLastError();
+                closeSocket(socket_id);
+                setLastError(error);
+                return -1;
+            }
+        }
+
+        return socket_id;
+    }
+
+    // Check whether a connection attempt that finished waiting succeeded.
+    bool connectionSucceeded(int socket_id)
+    {
+        int error = 0;
+        socklen_t error_size = sizeof(error);
+        if(::getsockopt(socket_id, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &error_size) != 0)
+        {
+            return false;
+        }
+
+        if(error != 0)
+        {
+            setLastError(error);
+            return false;
+        }
+        return true;
+    }
 }
 
 Arcus::Private::PlatformSocket::PlatformSocket()
+    : _socket_id(-1)
+    , _tcp(true)
+    , _datagram_socket_id(-1)
 {
 #ifdef _WIN32
     initializeWSA();
@@ -81,28 +337,195 @@ Arcus::Private::PlatformSocket::~PlatformSocket()
 {
 }
 
-bool Arcus::Private::PlatformSocket::create()
+bool Arcus::Private::PlatformSocket::create(int family)
 {
-    _socket_id = ::socket(AF_INET, SOCK_STREAM, 0);
+    _socket_id = ::socket(family, SOCK_STREAM, 0);
     return _socket_id != -1;
 }
 
-bool Arcus::Private::PlatformSocket::connect(const std::string& address, int port)
+bool Arcus::Private::PlatformSocket::connect(const std::string& address, int port, int timeout, bool fast_open, std::function<bool()> aborted)
 {
-    auto address_data = createAddress(address, port);
-    int result = ::connect(_socket_id, reinterpret_cast<sockaddr*>(&address_data), sizeof(address_data));
-    return result == 0;
+    _tcp = true;
+
+    std::vector<ResolvedAddress> addresses;
+    if(!resolveAddress(address, port, false, addresses))
+    {
+        return false;
+    }
+
+    // Connect to the addresses in order, starting the next attempt while earlier ones are still
+    // in progress if they take too long, and use the first connection that is established.
+    const auto start = std::chrono::steady_clock::now();
+    const auto deadline = start + std::chrono::milliseconds(timeout);
+    auto next_attempt = start;
+    std::size_t next_address = 0;
+    std::vector<PollEntry> attempts;
+    int connected_socket = -1;
+    int last_error = 0;
+
+    while(connected_socket == -1)
+    {
+        if(aborted && aborted())
+        {
+        #ifdef _WIN32
+            last_error = WSAECONNABORTED;
+        #else
+            last_error = ECONNABORTED;
+        #endif
+            break;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if(timeout > 0 && now >= deadline)
+        {
+        #ifdef _WIN32
+            last_error = WSAETIMEDOUT;
+        #else
+            last_error = ETIMEDOUT;
+        #endif
+            break;
+        }
+
+        if(next_address < addresses.size() && (now >= next_attempt || attempts.empty()))
+        {
+            int socket_id = startConnection(addresses[next_address++], _options, fast_open);
+            if(socket_id == -1)
+            {
+                last_error = getLastError();
+                continue;
+            }
+
+            PollEntry attempt;
+            attempt.fd = socket_id;
+            attempt.events = POLL_WRITABLE;
+            attempt.revents = 0;
+            attempts.push_back(attempt);
+            next_attempt = now + std::chrono::milliseconds(connection_attempt_delay);
+            continue;
+        }
+
+        if(attempts.empty())
+        {
+            break;
+        }
+
+        int wait_time = -1;
+        if(next_address < addresses.size())
+        {
+            wait_time = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next_attempt - now).count());
+        }
+        if(timeout > 0)
+        {
+            int remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count());
+            wait_time = wait_time < 0 ? remaining : std::min(wait_time, remaining);
+        }
+        // The attempts are not known to anyone else, so closing the socket cannot interrupt the wait.
+        if(aborted)
+        {
+            wait_time = wait_time < 0 ? abort_check_interval : std::min(wait_time, abort_check_interval);
+        }
+
+        if(pollSockets(attempts.data(), attempts.size(), std::max(wait_time, -1)) <= 0)
+        {
+            continue;
+        }
+
+        for(auto attempt = attempts.begin(); attempt != attempts.end();)
+        {
+            if(attempt->revents == 0)
+            {
+                ++attempt;
+                continue;
+            }
+
+            if(connectionSucceeded(attempt->fd))
+            {
+                connected_socket = attempt->fd;
+                attempts.erase(attempt);
+                break;
+            }
+
+            // Try the next address right away instead of waiting for the attempt delay.
+            last_error = getLastError();
+            closeSocket(attempt->fd);
+            attempt = attempts.erase(attempt);
+            next_attempt = std::chrono::steady_clock::now();
+        }
+    }
+
+    for(auto& attempt : attempts)
+    {
+        closeSocket(attempt.fd);
+    }
+
+    if(connected_socket == -1 || !setBlocking(connected_socket, true))
+    {
+        setLastError(last_error);
+        return false;
+    }
+
+    _socket_id = connected_socket;
+    return true;
 }
 
 bool Arcus::Private::PlatformSocket::bind(const std::string& address, int port)
 {
-    auto address_data = createAddress(address, port);
-    int result = ::bind(_socket_id, reinterpret_cast<sockaddr*>(&address_data), sizeof(address_data));
+    _tcp = true;
+
+    std::vector<ResolvedAddress> addresses;
+    if(!resolveAddress(address, port, true, addresses))
+    {
+        return false;
+    }
+
+    const ResolvedAddress& bind_address = addresses.front();
+    if(!create(bind_address.family))
+    {
+        return false;
+    }
+
+    // Accepted connections inherit the buffer sizes of the listening socket.
+    setBufferSizes(_socket_id, _options);
+
+#ifdef SO_REUSEPORT
+    if(_options.reuse_port)
+    {
+        setSocketOption(_socket_id, SOL_SOCKET, SO_REUSEPORT, 1);
+
+    #ifdef SO_INCOMING_CPU
+        // Prefer this socket for connections handled by the processor its thread runs on.
+        if(_options.thread_cpu >= 0)
+        {
+            setSocketOption(_socket_id, SOL_SOCKET, SO_INCOMING_CPU, _options.thread_cpu);
+        }
+    #endif
+    }
+#endif
+
+    if(bind_address.family == AF_INET6)
+    {
+        // Also accept IPv4 connections when listening on all IPv6 addresses.
+        int v6_only = 0;
+        ::setsockopt(_socket_id, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast<const char*>(&v6_only), sizeof(v6_only));
+    }
+
+    int result = ::bind(_socket_id, reinterpret_cast<const sockaddr*>(&bind_address.address), bind_address.size);
     return result == 0;
 }
 
-bool Arcus::Private::PlatformSocket::listen(int backlog)
+bool Arcus::Private::PlatformSocket::listen(int backlog, bool fast_open)
 {
+#ifdef TCP_FASTOPEN
+    if(fast_open)
+    {
+        // The amount of pending fast open connections that are accepted.
+        int queue_length = 16;
+        ::setsockopt(_socket_id, IPPROTO_TCP, TCP_FASTOPEN, reinterpret_cast<const char*>(&queue_length), sizeof(queue_length));
+    }
+#else
+    (void)fast_open;
+#endif
+
     int result = ::listen(_socket_id, backlog);
     return result == 0;
 }
@@ -128,8 +551,101 @@ bool Arcus::Private::PlatformSocket::accept()
     }
 }
 
+bool Arcus::Private::PlatformSocket::adopt(int socket_id)
+{
+    int type = 0;
+    socklen_t length = sizeof(type);
+    if(::getsockopt(socket_id, SOL_SOCKET, SO_TYPE, reinterpret_cast<char*>(&type), &length) != 0 || type != SOCK_STREAM)
+    {
+        return false;
+    }
+
+    sockaddr_storage local_address;
+    length = sizeof(local_address);
+    if(::getsockname(socket_id, reinterpret_cast<sockaddr*>(&local_address), &length) != 0)
+    {
+        return false;
+    }
+
+    // The socket may have been used in non-blocking mode by its previous owner.
+    if(!setBlocking(socket_id, true))
+    {
+        return false;
+    }
+
+    _socket_id = socket_id;
+    _tcp = local_address.ss_family == AF_INET || local_address.ss_family == AF_INET6;
+    return true;
+}
+
+bool Arcus::Private::PlatformSocket::createPair(int& first, int& second)
+{
+#ifdef _WIN32
+    // There are no local socket pairs on Windows, so connect two sockets over the loopback interface.
+    initializeWSA();
+
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    if(listener == -1)
+    {
+        return false;
+    }
+
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t length = sizeof(address);
+
+    int connecting = -1;
+    int accepted = -1;
+    if(::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0
+        && ::getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length) == 0
+        && ::listen(listener, 1) == 0)
+    {
+        connecting = ::socket(AF_INET, SOCK_STREAM, 0);
+        if(connecting != -1 && ::connect(connecting, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+        {
+            accepted = ::accept(listener, 0, 0);
+        }
+    }
+    closeSocket(listener);
+
+    if(accepted == -1)
+    {
+        if(connecting != -1)
+        {
+            closeSocket(connecting);
+        }
+        return false;
+    }
+
+    SetHandleInformation(reinterpret_cast<HANDLE>(static_cast<intptr_t>(connecting)), HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(reinterpret_cast<HANDLE>(static_cast<intptr_t>(accepted)), HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+    first = connecting;
+    second = accepted;
+    return true;
+#else
+    int sockets[2];
+    if(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+    {
+        return false;
+    }
+
+    ::fcntl(sockets[0], F_SETFD, FD_CLOEXEC);
+    first = sockets[0];
+    second = sockets[1];
+    return true;
+#endif
+}
+
 bool Arcus::Private::PlatformSocket::close()
 {
+    if(_socket_id == -1)
+    {
+        return true;
+    }
+
     int result = 0;
     #ifdef _WIN32
         result = ::closesocket(_socket_id);
@@ -137,6 +653,8 @@ bool Arcus::Private::PlatformSocket::close()
         result = ::close(_socket_id);
     #endif
 
+    // Prevent closing a socket that reuses the same ID later on.
+    _socket_id = -1;
     return result == 0;
 }
 
@@ -172,12 +690,15 @@ bool Arcus::Private::PlatformSocket::shutdown(PlatformSocket::ShutdownDirection
 
 void Arcus::Private::PlatformSocket::flush()
 {
-    char* buffer = new char[256];
-    socket_size num = 0;
+    char buffer[256];
 
-    while(num > 0)
+    // Only read while data is waiting, since recv() blocks on platforms without MSG_DONTWAIT.
+    while(waitForData(0))
     {
-        num = ::recv(_socket_id, buffer, 256, MSG_DONTWAIT);
+        if(::recv(_socket_id, buffer, sizeof(buffer), MSG_DONTWAIT) <= 0)
+        {
+            break;
+        }
     }
 }
 
@@ -193,6 +714,29 @@ socket_size Arcus::Private::PlatformSocket::writeBytes(std::size_t size, const c
     return ::send(_socket_id, data, size, MSG_NOSIGNAL);
 }
 
+socket_size Arcus::Private::PlatformSocket::writeBytesNonBlocking(std::size_t size, const char* data)
+{
+    #ifdef _WIN32
+        // There is no MSG_DONTWAIT, so only write when the send buffer has room.
+        WSAPOLLFD poll_data;
+        poll_data.fd = _socket_id;
+        poll_data.events = POLLWRNORM;
+        poll_data.revents = 0;
+        if(::WSAPoll(&poll_data, 1, 0) == 0)
+        {
+            return 0;
+        }
+        return ::send(_socket_id, data, size, 0);
+    #else
+        socket_size result = ::send(_socket_id, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return 0;
+        }
+        return result;
+    #endif
+}
+
 socket_size Arcus::Private::PlatformSocket::readUInt32(uint32_t* output)
 {
     #ifndef _WIN32
@@ -235,6 +779,14 @@ socket_size Arcus::Private::PlatformSocket::readBytes(std::size_t size, char* ou
 
     socket_size num = ::recv(_socket_id, output, size, 0);
 
+    #ifdef TCP_QUICKACK
+        // The kernel returns to delayed acknowledgements by itself, so keep enabling quick acknowledgements.
+        if(num > 0 && _options.quick_ack && _tcp)
+        {
+            setSocketOption(_socket_id, IPPROTO_TCP, TCP_QUICKACK, 1);
+        }
+    #endif
+
     #ifdef _WIN32
         if(num == SOCKET_ERROR && WSAGetLastError() == WSAETIMEDOUT)
         {
@@ -250,6 +802,214 @@ socket_size Arcus::Private::PlatformSocket::readBytes(std::size_t size, char* ou
     return num;
 }
 
+bool Arcus::Private::PlatformSocket::waitForData(int timeout)
+{
+    #ifdef _WIN32
+        WSAPOLLFD poll_data;
+        poll_data.fd = _socket_id;
+        poll_data.events = POLLRDNORM;
+        poll_data.revents = 0;
+        int result = ::WSAPoll(&poll_data, 1, timeout);
+    #else
+        pollfd poll_data;
+        poll_data.fd = _socket_id;
+        poll_data.events = POLLIN;
+        poll_data.revents = 0;
+        int result = ::poll(&poll_data, 1, timeout);
+    #endif
+
+    // Errors and hangups are reported as available data, so the following read reports them.
+    return result > 0 && poll_data.revents != 0;
+}
+
+bool Arcus::Private::PlatformSocket::waitForData(int timeout, bool& datagram_available)
+{
+    datagram_available = false;
+    if(_datagram_socket_id == -1)
+    {
+        return waitForData(timeout);
+    }
+
+    PollEntry poll_data[2];
+    poll_data[0].fd = _socket_id;
+    poll_data[1].fd = _datagram_socket_id;
+    for(PollEntry& entry : poll_data)
+    {
+    #ifdef _WIN32
+        entry.events = POLLRDNORM;
+    #else
+        entry.events = POLLIN;
+    #endif
+        entry.revents = 0;
+    }
+
+    int result = pollSockets(poll_data, 2, timeout);
+    if(result <= 0)
+    {
+        return false;
+    }
+
+    datagram_available = poll_data[1].revents != 0;
+    return poll_data[0].revents != 0;
+}
+
+int Arcus::Private::PlatformSocket::openDatagramChannel()
+{
+    closeDatagramChannel();
+    if(!_tcp)
+    {
+        return 0;
+    }
+
+    sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    if(::getsockname(_socket_id, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+    {
+        return 0;
+    }
+
+    // Use the same local address as the connection, with any free port.
+    if(address.ss_family == AF_INET6)
+    {
+        reinterpret_cast<sockaddr_in6*>(&address)->sin6_port = 0;
+    }
+    else
+    {
+        reinterpret_cast<sockaddr_in*>(&address)->sin_port = 0;
+    }
+
+    int socket_id = ::socket(address.ss_family, SOCK_DGRAM, 0);
+    if(socket_id == -1)
+    {
+        return 0;
+    }
+
+    if(::bind(socket_id, reinterpret_cast<sockaddr*>(&address), length) != 0
+        || ::getsockname(socket_id, reinterpret_cast<sockaddr*>(&address), &length) != 0
+        || !setBlocking(socket_id, false))
+    {
+        closeSocket(socket_id);
+        return 0;
+    }
+
+    _datagram_socket_id = socket_id;
+    return ntohs(address.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6*>(&address)->sin6_port : reinterpret_cast<sockaddr_in*>(&address)->sin_port);
+}
+
+bool Arcus::Private::PlatformSocket::connectDatagramChannel(int port)
+{
+    if(_datagram_socket_id == -1)
+    {
+        return false;
+    }
+
+    sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    if(::getpeername(_socket_id, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+    {
+        return false;
+    }
+
+    if(address.ss_family == AF_INET6)
+    {
+        reinterpret_cast<sockaddr_in6*>(&address)->sin6_port = htons(port);
+    }
+    else
+    {
+        reinterpret_cast<sockaddr_in*>(&address)->sin_port = htons(port);
+    }
+
+    return ::connect(_datagram_socket_id, reinterpret_cast<sockaddr*>(&address), length) == 0;
+}
+
+void Arcus::Private::PlatformSocket::closeDatagramChannel()
+{
+    if(_datagram_socket_id != -1)
+    {
+        closeSocket(_datagram_socket_id);
+        _datagram_socket_id = -1;
+    }
+}
+
+socket_size Arcus::Private::PlatformSocket::writeDatagram(std::size_t size, const char* data)
+{
+    // A full send buffer drops the datagram instead of waiting for room.
+    return ::send(_datagram_socket_id, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+socket_size Arcus::Private::PlatformSocket::readDatagram(std::size_t size, char* output)
+{
+    socket_size num = ::recv(_datagram_socket_id, output, size, MSG_DONTWAIT);
+    if(num < 0)
+    {
+        #ifdef _WIN32
+            // Datagrams that do not fit the buffer are truncated, as on other platforms.
+            if(WSAGetLastError() == WSAEMSGSIZE)
+            {
+                return size;
+            }
+            if(WSAGetLastError() == WSAEWOULDBLOCK)
+            {
+                return 0;
+            }
+        #else
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return 0;
+            }
+        #endif
+    }
+
+    return num;
+}
+
+void Arcus::Private::PlatformSocket::setOptions(const SocketOptions& options)
+{
+    _options = options;
+}
+
+bool Arcus::Private::PlatformSocket::applyOptions()
+{
+    bool result = setBufferSizes(_socket_id, _options);
+
+    if(_options.no_delay && _tcp)
+    {
+        result &= setSocketOption(_socket_id, IPPROTO_TCP, TCP_NODELAY, 1);
+    }
+
+#ifdef SO_BUSY_POLL
+    if(_options.busy_poll > 0)
+    {
+        result &= setSocketOption(_socket_id, SOL_SOCKET, SO_BUSY_POLL, _options.busy_poll);
+    }
+#endif
+
+#ifdef TCP_QUICKACK
+    if(_options.quick_ack && _tcp)
+    {
+        result &= setSocketOption(_socket_id, IPPROTO_TCP, TCP_QUICKACK, 1);
+    }
+#endif
+
+    return result;
+}
+
+void Arcus::Private::PlatformSocket::setCork(bool corked)
+{
+    if(!_tcp)
+    {
+        return;
+    }
+
+#if defined(TCP_CORK)
+    setSocketOption(_socket_id, IPPROTO_TCP, TCP_CORK, corked ? 1 : 0);
+#elif defined(TCP_NOPUSH)
+    setSocketOption(_socket_id, IPPROTO_TCP, TCP_NOPUSH, corked ? 1 : 0);
+#else
+    (void)corked;
+#endif
+}
+
 bool Arcus::Private::PlatformSocket::setReceiveTimeout(int timeout)
 {
     int result = 0;
@@ -258,8 +1018,8 @@ bool Arcus::Private::PlatformSocket::setReceiveTimeout(int timeout)
         return result != SOCKET_ERROR;
     #else
         timeval t;
-        t.tv_sec = 0;
-        t.tv_usec = timeout * 1000;
+        t.tv_sec = timeout / 1000;
+        t.tv_usec = (timeout % 1000) * 1000;
         result = ::setsockopt(_socket_id, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&t), sizeof(t));
         return result == 0;
     #endif
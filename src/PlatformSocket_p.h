@@ -19,9 +19,12 @@
 #ifndef ARCUS_PLATFORM_SOCKET_P_H
 #define ARCUS_PLATFORM_SOCKET_P_H
 
+#include <functional>
 #include <memory>
 #include <string>
 
+#include "Types.h"
+
 namespace Arcus
 {
     namespace Private
@@ -54,22 +57,32 @@ namespace Arcus
             /**
              * Create the socket.
              *
+             * \param family The address family of the socket.
+             *
              * \return true if socket creation was successful, false if not.
              */
-            bool create();
+            bool create(int family);
             /**
-             * Connect to an IP address and port.
+             * Connect to a host and port.
              *
-             * \param address The IP address to connect to.
-             * \param port The port to bind to.
+             * The host name is resolved into its IPv4 and IPv6 addresses. When there are several,
+             * a connection attempt to the next address is started in parallel whenever an attempt
+             * takes longer than 250 milliseconds, and the first connection that is established is used.
+             *
+             * \param address The host name or IPv4 or IPv6 address to connect to.
+             * \param port The port to connect to.
+             * \param timeout The maximum amount of time in milliseconds to wait for the
+             * connection to be established, or 0 to wait as long as the platform does.
+             * \param fast_open Whether to use TCP Fast Open, where supported.
+             * \param aborted Checked regularly while waiting, connecting stops once it returns true.
              *
              * \return true if the connection was successful, false if not.
              */
-            bool connect(const std::string& address, int port);
+            bool connect(const std::string& address, int port, int timeout = 0, bool fast_open = false, std::function<bool()> aborted = std::function<bool()>());
             /**
-             * Bind the socket to an address and port.
+             * Create the socket and bind it to an address and port.
              *
-             * \param address The IP address to bind to.
+             * \param address The host name or IPv4 or IPv6 address to bind to.
              * \param port The port to bind to.
              *
              * \return true if successful, false if not.
@@ -79,10 +92,11 @@ namespace Arcus
              * Mark the socket as listening for new connections.
              *
              * \param backlog The amount of queued connections to accept.
+             * \param fast_open Whether to accept TCP Fast Open connections, where supported.
              *
              * \return true if successful, false if not.
              */
-            bool listen(int backlog);
+            bool listen(int backlog, bool fast_open = false);
             /**
              * Accept the waiting incoming connection and use it as connected socket.
              *
@@ -91,6 +105,25 @@ namespace Arcus
              * \note This call will block until there is a connection waiting to be accepted.
              */
             bool accept();
+            /**
+             * Use an already connected socket.
+             *
+             * \param socket_id The file descriptor or handle of a connected stream socket.
+             *
+             * \return true if the socket can be used, false if not.
+             */
+            bool adopt(int socket_id);
+            /**
+             * Create a pair of sockets that are connected to each other.
+             *
+             * The second socket is inherited by child processes, the first one is not.
+             *
+             * \param first Set to the socket that is not inherited.
+             * \param second Set to the socket that is inherited.
+             *
+             * \return true if successful, false if not.
+             */
+            static bool createPair(int& first, int& second);
             /**
              * Close the socket.
              *
@@ -133,6 +166,15 @@ namespace Arcus
              * \return The amount of bytes written, or -1 if an error occurred.
              */
             socket_size writeBytes(std::size_t size, const char* data);
+            /**
+             * Write data to the socket without waiting for room in the send buffer.
+             *
+             * \param size The amount of data to write.
+             * \param data A pointer to the data to send.
+             *
+             * \return The amount of bytes written, 0 if the send buffer is full, or -1 if an error occurred.
+             */
+            socket_size writeBytesNonBlocking(std::size_t size, const char* data);
             /**
              * Read an unsigned 32-bit integer from the socket.
              *
@@ -155,6 +197,92 @@ namespace Arcus
              */
             socket_size readBytes(std::size_t size, char* output);
 
+            /**
+             * Wait until there is data available to be read.
+             *
+             * \param timeout The maximum amount of time in milliseconds to wait.
+             *
+             * \return true if data is available or the socket is in an error state,
+             * false if the timeout passed without data becoming available.
+             */
+            bool waitForData(int timeout);
+            /**
+             * Wait until there is data available to be read from the socket or the datagram channel.
+             *
+             * \param timeout The maximum amount of time in milliseconds to wait.
+             * \param datagram_available Set to whether a datagram is waiting to be read.
+             *
+             * \return true if data is available on the socket or it is in an error state, false if not.
+             */
+            bool waitForData(int timeout, bool& datagram_available);
+
+            /**
+             * Open a datagram channel next to the connected socket.
+             *
+             * The channel uses UDP on the local address of the connection. This is only supported
+             * for TCP connections.
+             *
+             * \return The local port of the channel, or 0 if it could not be opened.
+             */
+            int openDatagramChannel();
+            /**
+             * Send the datagrams of the channel to a port of the peer of the connected socket.
+             *
+             * Only datagrams from that port are received afterwards.
+             *
+             * \param port The port of the datagram channel of the peer.
+             *
+             * \return true if successful, false if not.
+             */
+            bool connectDatagramChannel(int port);
+            /**
+             * Close the datagram channel, if it is open.
+             */
+            void closeDatagramChannel();
+            /**
+             * Send a datagram without blocking.
+             *
+             * \param size The size of the datagram.
+             * \param data A pointer to the data to send.
+             *
+             * \return The amount of bytes sent, or -1 if an error occurred or the datagram
+             * could not be sent without blocking.
+             */
+            socket_size writeDatagram(std::size_t size, const char* data);
+            /**
+             * Receive a datagram without blocking.
+             *
+             * \param size The size of the output buffer. The rest of longer datagrams is discarded.
+             * \param output A pointer to a block of data that can be written to.
+             *
+             * \return The amount of bytes read, 0 if no datagram is waiting or -1 if an error occurred.
+             */
+            socket_size readDatagram(std::size_t size, char* output);
+
+            /**
+             * Set the options used for the connection.
+             *
+             * The buffer sizes are applied to sockets created after this call, before connecting.
+             * The other options are applied by applyOptions().
+             *
+             * \param options The options to use.
+             */
+            void setOptions(const SocketOptions& options);
+            /**
+             * Apply the options to the connected socket.
+             *
+             * \return true if all options supported by the platform could be applied, false if not.
+             */
+            bool applyOptions();
+            /**
+             * Hold back partial packets until the socket is uncorked.
+             *
+             * This does nothing on platforms that do not support corking.
+             *
+             * \param corked Whether to hold back partial packets.
+             */
+            void setCork(bool corked);
+
             /**
              * Set the timeout for the read-related methods.
              *
@@ -172,6 +300,9 @@ namespace Arcus
 
         private:
             int _socket_id;
+            SocketOptions _options;
+            bool _tcp; // Do TCP options apply? False for local sockets.
+            int _datagram_socket_id;
         };
     }
 }
@@ -0,0 +1,78 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PlatformThread_p.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+bool Arcus::Private::PlatformThread::setName(const std::string& name)
+{
+#if defined(_WIN32)
+    (void)name;
+    return false;
+#elif defined(__APPLE__)
+    return ::pthread_setname_np(name.substr(0, 63).c_str()) == 0;
+#else
+    return ::pthread_setname_np(::pthread_self(), name.substr(0, 15).c_str()) == 0;
+#endif
+}
+
+bool Arcus::Private::PlatformThread::setAffinity(int cpu)
+{
+    if(cpu < 0)
+    {
+        return false;
+    }
+
+#if defined(_WIN32)
+    if(cpu >= static_cast<int>(sizeof(DWORD_PTR) * 8))
+    {
+        return false;
+    }
+    return ::SetThreadAffinityMask(::GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#elif defined(__linux__)
+    if(cpu >= CPU_SETSIZE)
+    {
+        return false;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+    return false;
+#endif
+}
+
+bool Arcus::Private::PlatformThread::setPriority(int priority)
+{
+#ifdef _WIN32
+    // Windows only has a few priority levels, so map the range onto those above normal.
+    int level = priority >= 90 ? THREAD_PRIORITY_TIME_CRITICAL : (priority >= 50 ? THREAD_PRIORITY_HIGHEST : THREAD_PRIORITY_ABOVE_NORMAL);
+    return ::SetThreadPriority(::GetCurrentThread(), level) != 0;
+#else
+    sched_param parameters;
+    parameters.sched_priority = priority;
+    return ::pthread_setschedparam(::pthread_self(), SCHED_FIFO, &parameters) == 0;
+#endif
+}
@@ -0,0 +1,63 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCUS_PLATFORM_THREAD_P_H
+#define ARCUS_PLATFORM_THREAD_P_H
+
+#include <string>
+
+namespace Arcus
+{
+    namespace Private
+    {
+        /**
+         * Functions that wrap the platform C API for configuring the calling thread.
+         */
+        namespace PlatformThread
+        {
+            /**
+             * Set the name of the calling thread, as shown by debuggers and profilers.
+             *
+             * \param name The name of the thread. Some platforms only use the first 15 characters.
+             *
+             * \return true if successful, false if not.
+             */
+            bool setName(const std::string& name);
+            /**
+             * Restrict the calling thread to run on a single processor.
+             *
+             * \param cpu The index of the processor to run on.
+             *
+             * \return true if successful, false if not or if the platform does not support this.
+             */
+            bool setAffinity(int cpu);
+            /**
+             * Set the scheduling priority of the calling thread.
+             *
+             * \param priority A real-time priority from 1 to 99, where higher runs first.
+             *
+             * \return true if successful, false if not.
+             *
+             * \note Real-time priorities usually require elevated privileges.
+             */
+            bool setPriority(int priority);
+        }
+    }
+}
+
+#endif //ARCUS_PLATFORM_THREAD_P_H
@@ -0,0 +1,61 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SendHandle.h"
+#include "OutgoingMessage_p.h"
+
+using namespace Arcus;
+
+SendHandle::SendHandle()
+{
+}
+
+SendHandle::SendHandle(const std::shared_ptr<Private::OutgoingMessage>& message) : _message(message)
+{
+}
+
+bool SendHandle::isValid() const
+{
+    return bool(_message);
+}
+
+SendStatus::SendStatus SendHandle::getStatus() const
+{
+    if(!_message)
+    {
+        return SendStatus::Failed;
+    }
+
+    return _message->status;
+}
+
+bool SendHandle::cancel()
+{
+    if(!_message)
+    {
+        return false;
+    }
+
+    if(_message->changeStatus(SendStatus::Queued, SendStatus::Cancelled))
+    {
+        return true;
+    }
+
+    // Chunked frames are checked for cancellation before sending each chunk.
+    return _message->chunked && _message->changeStatus(SendStatus::Sending, SendStatus::Cancelled);
+}
@@ -0,0 +1,81 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCUS_SEND_HANDLE_H
+#define ARCUS_SEND_HANDLE_H
+
+#include <memory>
+
+#include "ArcusExport.h"
+#include "Types.h"
+
+namespace Arcus
+{
+    namespace Private
+    {
+        class OutgoingMessage;
+    }
+
+    /**
+     * A handle to a message passed to Socket::sendMessage().
+     *
+     * The handle can be used to follow the status of the message and to
+     * cancel it when it is no longer needed. Copies of a handle refer to
+     * the same message.
+     */
+    class ARCUS_EXPORT SendHandle
+    {
+    public:
+        /**
+         * Create an invalid handle that does not refer to any message.
+         */
+        SendHandle();
+
+        /**
+         * Does this handle refer to a message?
+         */
+        bool isValid() const;
+        /**
+         * Get the current status of the message.
+         *
+         * An invalid handle always reports SendStatus::Failed.
+         */
+        SendStatus::SendStatus getStatus() const;
+        /**
+         * Cancel sending the message.
+         *
+         * A message that is still queued will not be sent at all. A message that
+         * is being sent as a chunked frame is aborted, after which the receiving
+         * side discards what it received so far. Other messages that are already
+         * being sent cannot be cancelled.
+         *
+         * \return true if the message was cancelled, false if it was too late to do so.
+         */
+        bool cancel();
+
+    private:
+        // So only Socket can create valid handles.
+        friend class Socket;
+
+        SendHandle(const std::shared_ptr<Private::OutgoingMessage>& message);
+
+        std::shared_ptr<Private::OutgoingMessage> _message;
+    };
+}
+
+#endif //ARCUS_SEND_HANDLE_H
@@ -0,0 +1,81 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCUS_SEND_QUEUE_P_H
+#define ARCUS_SEND_QUEUE_P_H
+
+#include <deque>
+#include <memory>
+
+#include "OutgoingMessage_p.h"
+
+namespace Arcus
+{
+    namespace Private
+    {
+        /**
+         * Private class that queues outgoing messages by priority.
+         *
+         * Messages are taken in order of priority and in FIFO order within a priority.
+         * This class is not thread safe, access to it should be guarded by a mutex.
+         */
+        class SendQueue
+        {
+        public:
+            // Add a message to the end of the queue for its priority.
+            inline void push(const std::shared_ptr<OutgoingMessage>& message)
+            {
+                queues[message->priority].push_back(message);
+            }
+
+            // Remove and return the oldest message of the highest priority, or nullptr if the queue is empty.
+            inline std::shared_ptr<OutgoingMessage> pop()
+            {
+                for(auto& queue : queues)
+                {
+                    if(!queue.empty())
+                    {
+                        std::shared_ptr<OutgoingMessage> message = queue.front();
+                        queue.pop_front();
+                        return message;
+                    }
+                }
+
+                return nullptr;
+            }
+
+            // Return the amount of queued messages.
+            inline std::size_t size() const
+            {
+                std::size_t result = 0;
+                for(auto& queue : queues)
+                {
+                    result += queue.size();
+                }
+                return result;
+            }
+
+        private:
+            static const int priority_count = MessagePriority::Low + 1;
+
+            std::deque<std::shared_ptr<OutgoingMessage>> queues[priority_count];
+        };
+    }
+}
+
+#endif //ARCUS_SEND_QUEUE_P_H
@@ -0,0 +1,141 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SendScheduler_p.h"
+
+#include <algorithm>
+#include <thread>
+
+using namespace Arcus::Private;
+
+SendScheduler::Flow::Flow()
+    : rate(0)
+    , burst(SendScheduler::default_burst)
+    , weight(1)
+    , tokens(SendScheduler::default_burst)
+    , last_refill(std::chrono::steady_clock::now())
+    , finish_time(0)
+{
+}
+
+void SendScheduler::Flow::configure(uint64_t maximum_rate, uint32_t burst_size, int share)
+{
+    rate = maximum_rate;
+    burst = burst_size > 0 ? burst_size : SendScheduler::default_burst;
+    weight = std::max(share, 1);
+    tokens = burst;
+    last_refill = std::chrono::steady_clock::now();
+    finish_time = 0;
+}
+
+SendScheduler::SendScheduler()
+    : total_rate(0)
+    , total_tokens(default_burst)
+    , last_refill(std::chrono::steady_clock::now())
+    , virtual_time(0)
+    , next_arrival(0)
+{
+}
+
+SendScheduler& SendScheduler::getInstance()
+{
+    static SendScheduler instance;
+    return instance;
+}
+
+void SendScheduler::setTotalRate(uint64_t rate)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    total_rate = rate;
+    total_tokens = default_burst;
+    last_refill = std::chrono::steady_clock::now();
+    condition_variable.notify_all();
+}
+
+uint64_t SendScheduler::getTotalRate() const
+{
+    return total_rate;
+}
+
+bool SendScheduler::isLimited(const Flow& flow) const
+{
+    return flow.rate > 0 || total_rate > 0;
+}
+
+void SendScheduler::acquire(Flow& flow, uint32_t size)
+{
+    // The tokens of a bucket may become negative, so data larger than the burst size can be sent.
+    if(flow.rate > 0)
+    {
+        refill(flow.tokens, flow.last_refill, flow.rate, flow.burst);
+        if(flow.tokens < 0)
+        {
+            std::this_thread::sleep_for(std::chrono::duration<double>(-flow.tokens / flow.rate));
+            refill(flow.tokens, flow.last_refill, flow.rate, flow.burst);
+        }
+        flow.tokens -= size;
+    }
+
+    if(total_rate == 0)
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // A flow that was idle starts at the current virtual time, so it cannot claim bandwidth it did not use.
+    flow.finish_time = std::max(virtual_time, flow.finish_time) + static_cast<double>(size) / flow.weight;
+    auto entry = waiting.emplace(flow.finish_time, next_arrival++).first;
+
+    while(true)
+    {
+        const uint64_t rate = total_rate;
+        if(rate == 0)
+        {
+            break;
+        }
+
+        if(waiting.begin() != entry)
+        {
+            // Data that finishes earlier goes first.
+            condition_variable.wait(lock);
+            continue;
+        }
+
+        refill(total_tokens, last_refill, rate, default_burst);
+        if(total_tokens >= 0)
+        {
+            total_tokens -= size;
+            break;
+        }
+
+        condition_variable.wait_for(lock, std::chrono::duration<double>(-total_tokens / rate));
+    }
+
+    virtual_time = entry->first;
+    waiting.erase(entry);
+    condition_variable.notify_all();
+}
+
+void SendScheduler::refill(double& tokens, std::chrono::steady_clock::time_point& last_refill, uint64_t rate, uint64_t burst)
+{
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - last_refill).count();
+    tokens = std::min(static_cast<double>(burst), tokens + elapsed * rate);
+    last_refill = now;
+}
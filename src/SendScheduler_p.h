@@ -0,0 +1,131 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCUS_SEND_SCHEDULER_P_H
+#define ARCUS_SEND_SCHEDULER_P_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <utility>
+
+namespace Arcus
+{
+    namespace Private
+    {
+        /**
+         * Private class that limits the rate at which sockets send data.
+         *
+         * Each socket can have its own rate limit, enforced with a token bucket. When the process has
+         * a total rate limit, the sockets that are sending at the same time are served using self-clocked
+         * fair queueing, so each gets a share of the total rate in proportion to its weight.
+         */
+        class SendScheduler
+        {
+        public:
+            /**
+             * The rate limit and scheduling state of a single socket.
+             *
+             * A flow is only used by the thread of its socket.
+             */
+            class Flow
+            {
+            public:
+                Flow();
+
+                /**
+                 * Set the rate limit and weight of the flow.
+                 *
+                 * \param maximum_rate The maximum rate in bytes per second, or 0 for no limit.
+                 * \param burst_size The amount of bytes that can be sent at once after being idle, or 0 for the default.
+                 * \param share The share of the total rate the flow gets when others are sending too.
+                 */
+                void configure(uint64_t maximum_rate, uint32_t burst_size, int share);
+
+            private:
+                friend class SendScheduler;
+
+                uint64_t rate;
+                uint64_t burst;
+                int weight;
+                double tokens;
+                std::chrono::steady_clock::time_point last_refill;
+                // Virtual time at which the last data of this flow finishes in the fair queue.
+                double finish_time;
+            };
+
+            /**
+             * Get the scheduler shared by all sockets in the process.
+             */
+            static SendScheduler& getInstance();
+
+            /**
+             * Set the total rate at which all sockets in the process may send data.
+             *
+             * \param rate The maximum rate in bytes per second, or 0 for no limit.
+             */
+            void setTotalRate(uint64_t rate);
+            /**
+             * Get the total rate at which all sockets in the process may send data, or 0 if there is no limit.
+             */
+            uint64_t getTotalRate() const;
+
+            /**
+             * Is the data of a flow subject to any rate limit?
+             */
+            bool isLimited(const Flow& flow) const;
+
+            /**
+             * Wait until a flow may send an amount of data, and account for it.
+             *
+             * Sending more than the burst size at once is allowed, after which the flow waits
+             * until the excess has been made up for.
+             *
+             * \param flow The flow of the socket that wants to send.
+             * \param size The amount of bytes to send.
+             */
+            void acquire(Flow& flow, uint32_t size);
+
+            // Default amount of bytes that can be sent at once after being idle.
+            static const uint32_t default_burst = 65536;
+
+        private:
+            SendScheduler();
+
+            // Add the tokens for the time since the last refill, up to the burst size.
+            static void refill(double& tokens, std::chrono::steady_clock::time_point& last_refill, uint64_t rate, uint64_t burst);
+
+            std::atomic<uint64_t> total_rate;
+
+            std::mutex mutex;
+            std::condition_variable condition_variable;
+            double total_tokens;
+            std::chrono::steady_clock::time_point last_refill;
+            // Virtual time of the fair queue, which is the finish time of the data that was last allowed to be sent.
+            double virtual_time;
+            // Data waiting to be sent, by virtual finish time and arrival order.
+            std::set<std::pair<double, uint64_t>> waiting;
+            uint64_t next_arrival;
+        };
+    }
+}
+
+#endif //ARCUS_SEND_SCHEDULER_P_H
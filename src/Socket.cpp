@@ -23,22 +23,27 @@
 
 using namespace Arcus;
 
-Socket::Socket() : d(new Private)
+Socket::Socket() : d(new Private(this))
 {
 }
 
 Socket::~Socket()
 {
+    // Wait until a SocketPool is done connecting the socket again, and keep it from doing so afterwards.
+    {
+        std::lock_guard<std::mutex> lifecycle_lock(d->lifecycle_mutex);
+        d->closed = true;
+    }
+
     if(d->thread)
     {
-        if(d->state != SocketState::Closed || d->state != SocketState::Error)
-        {
-            close();
-        }
-        delete d->thread;
+        close();
     }
 
-    for(SocketListener* listener : d->listeners)
+    // Handlers that are still running may use the socket.
+    d->handler_strands.waitForIdle();
+
+    for(SocketListener* listener : *d->listeners.load())
     {
         /* If deleting the socket listener while another thread is reporting an
          * error due to closing the socket, deleting the listener causes another
@@ -48,6 +53,19 @@ Socket::~Socket()
 
         delete listener;
     }
+
+    // Make sure no set refers to this socket anymore.
+    std::lock_guard<std::mutex> lock(d->socket_sets_mutex);
+    for(const auto& socket_set : d->socket_sets)
+    {
+        std::unique_lock<std::mutex> set_lock(socket_set->mutex);
+        socket_set->condition_variable.wait(set_lock, [&]()
+        {
+            return std::find(socket_set->busy.begin(), socket_set->busy.end(), this) == socket_set->busy.end();
+        });
+        socket_set->sockets.erase(std::remove(socket_set->sockets.begin(), socket_set->sockets.end(), this), socket_set->sockets.end());
+        socket_set->ready.erase(std::remove(socket_set->ready.begin(), socket_set->ready.end(), this), socket_set->ready.end());
+    }
 }
 
 SocketState::SocketState Socket::getState() const
@@ -67,12 +85,6 @@ void Socket::clearError()
 
 bool Socket::registerMessageType(const google::protobuf::Message* message_type)
 {
-    if(d->state != SocketState::Initial)
-    {
-        d->error(ErrorCode::InvalidStateError, "Socket is not in initial state");
-        return false;
-    }
-
     return d->message_types.registerMessageType(message_type);
 }
 
@@ -84,22 +96,67 @@ bool Socket::registerAllMessageTypes(const std::string& file_name)
         return false;
     }
 
+    if(!d->message_types.registerAllMessageTypes(file_name))
+    {
+        d->error(ErrorCode::MessageRegistrationFailedError, d->message_types.getErrorMessages());
+        return false;
+    }
+
+    return true;
+}
+
+bool Socket::registerStreamedField(const std::string& type_name, const std::string& field_name)
+{
     if(d->state != SocketState::Initial)
     {
         d->error(ErrorCode::MessageRegistrationFailedError, "Socket is not in initial state");
         return false;
     }
 
-    if(!d->message_types.registerAllMessageTypes(file_name))
+    MessagePtr message = d->message_types.createMessage(type_name);
+    if(!message)
     {
-        d->error(ErrorCode::MessageRegistrationFailedError, d->message_types.getErrorMessages());
+        d->error(ErrorCode::MessageRegistrationFailedError, "Unknown message type " + type_name);
         return false;
     }
 
+    auto field = message->GetDescriptor()->FindFieldByName(field_name);
+    if(!field || !field->is_repeated() || field->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE)
+    {
+        d->error(ErrorCode::MessageRegistrationFailedError, field_name + " is not a repeated message field of " + type_name);
+        return false;
+    }
+
+    auto prototype = message->GetReflection()->GetMessageFactory()->GetPrototype(field->message_type());
+    d->streamed_fields[d->message_types.getMessageTypeId(message)][field->number()] = prototype;
     return true;
 }
 
 void Socket::addListener(SocketListener* listener)
+{
+    listener->setSocket(this);
+
+    std::unique_lock<std::mutex> lock(d->listeners_mutex);
+    auto list = new Private::ListenerList(*d->listeners.load());
+    list->push_back(listener);
+    d->replaceListeners(list, lock);
+}
+
+void Socket::removeListener(SocketListener* listener)
+{
+    std::unique_lock<std::mutex> lock(d->listeners_mutex);
+    const Private::ListenerList* current = d->listeners.load();
+    if(std::find(current->begin(), current->end(), listener) == current->end())
+    {
+        return;
+    }
+
+    auto list = new Private::ListenerList(*current);
+    list->erase(std::remove(list->begin(), list->end(), listener), list->end());
+    d->replaceListeners(list, lock);
+}
+
+void Socket::setMessageHandler(MessageHandler* handler)
 {
     if(d->state != SocketState::Initial)
     {
@@ -107,20 +164,139 @@ void Socket::addListener(SocketListener* listener)
         return;
     }
 
-    listener->setSocket(this);
-    d->listeners.push_back(listener);
+    d->message_handler = handler;
 }
 
-void Socket::removeListener(SocketListener* listener)
+bool Socket::setMessageKeyField(const std::string& type_name, const std::string& field_name)
 {
     if(d->state != SocketState::Initial)
     {
         d->error(ErrorCode::InvalidStateError, "Socket is not in initial state");
-        return;
+        return false;
+    }
+
+    MessagePtr message = d->message_types.createMessage(type_name);
+    if(!message)
+    {
+        d->error(ErrorCode::MessageRegistrationFailedError, "Unknown message type " + type_name);
+        return false;
+    }
+
+    auto field = message->GetDescriptor()->FindFieldByName(field_name);
+    if(!field || field->is_repeated() || field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE
+        || field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_FLOAT || field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE)
+    {
+        d->error(ErrorCode::MessageRegistrationFailedError, field_name + " is not an integer, enum or string field of " + type_name);
+        return false;
+    }
+
+    d->message_key_fields[d->message_types.getMessageTypeId(message)] = field;
+    return true;
+}
+
+void Socket::setMessageHandlerThreadCount(int count)
+{
+    Executor::getInstance().setThreadCount(count);
+}
+
+int Socket::getMessageHandlerThreadCount()
+{
+    return Executor::getInstance().getThreadCount();
+}
+
+void Socket::setProgressInterval(int interval)
+{
+    d->progress_interval = std::max(interval, 0);
+}
+
+void Socket::setChunkedFrameSize(uint32_t minimum_size)
+{
+    d->chunked_frame_size = minimum_size;
+}
+
+void Socket::setBatching(int max_delay, uint32_t max_size)
+{
+    d->batch_delay = std::max(max_delay, 0);
+    d->batch_size = max_size;
+}
+
+void Socket::setCompactFrames(bool enabled)
+{
+    d->compact_frames = enabled;
+}
+
+void Socket::setFrameChecksums(bool enabled)
+{
+    d->frame_checksums = enabled;
+}
+
+void Socket::setConnectTimeout(int timeout)
+{
+    d->connect_timeout = std::max(timeout, 0);
+}
+
+void Socket::setConnectRetry(int retry_time, int initial_delay, int maximum_delay)
+{
+    d->connect_retry_time = std::max(retry_time, 0);
+    d->connect_retry_delay = std::max(initial_delay, 1);
+    d->connect_retry_maximum_delay = std::max(maximum_delay, initial_delay);
+}
+
+void Socket::setFastOpen(bool enabled)
+{
+    d->fast_open = enabled;
+}
+
+void Socket::setDirectWrite(bool enabled)
+{
+    d->direct_write = enabled;
+}
+
+void Socket::setDatagramChannel(bool enabled)
+{
+    d->datagram_channel = enabled;
+}
+
+bool Socket::setOptions(const SocketOptions& options)
+{
+    if(d->state != SocketState::Initial)
+    {
+        d->error(ErrorCode::InvalidStateError, "Socket is not in initial state");
+        return false;
     }
 
-    auto itr = std::find(d->listeners.begin(), d->listeners.end(), listener);
-    d->listeners.erase(itr);
+    d->options = options;
+    return true;
+}
+
+SocketOptions Socket::getOptions() const
+{
+    return d->options;
+}
+
+void Socket::setTotalSendRate(uint64_t bytes_per_second)
+{
+    SendScheduler::getInstance().setTotalRate(bytes_per_second);
+}
+
+uint64_t Socket::getTotalSendRate()
+{
+    return SendScheduler::getInstance().getTotalRate();
+}
+
+void Socket::setTotalReceiveMemoryLimit(uint64_t bytes)
+{
+    MemoryBudget::getInstance().setTotalLimit(bytes);
+}
+
+uint64_t Socket::getTotalReceiveMemoryLimit()
+{
+    return MemoryBudget::getInstance().getTotalLimit();
+}
+
+uint64_t Socket::getReceiveMemoryUsage() const
+{
+    return d->receive_memory.getUsed();
 }
 
 void Socket::connect(const std::string& address, int port)
@@ -133,10 +309,30 @@ void Socket::connect(const std::string& address, int port)
 
     d->address = address;
     d->port = port;
+    d->closed = false;
     d->thread = new std::thread([&]() { d->run(); });
     d->next_state = SocketState::Connecting;
 }
 
+void Socket::adoptFd(int fd)
+{
+    if(d->state != SocketState::Initial || d->thread != nullptr)
+    {
+        d->error(ErrorCode::InvalidStateError, "Socket is not in initial state");
+        return;
+    }
+
+    d->adopted_socket = fd;
+    d->closed = false;
+    d->thread = new std::thread([&]() { d->run(); });
+    d->next_state = SocketState::Connecting;
+}
+
+bool Socket::createSocketPair(int& parent_fd, int& child_fd)
+{
+    return Arcus::Private::PlatformSocket::createPair(parent_fd, child_fd);
+}
+
 void Socket::reset()
 {
     if (d->state != SocketState::Closed && d->state != SocketState::Error)
@@ -148,6 +344,7 @@ void Socket::reset()
     if(d->thread)
     {
         d->thread->join();
+        delete d->thread;
         d->thread = nullptr;
     }
 
@@ -166,23 +363,35 @@ void Socket::listen(const std::string& address, int port)
     
     d->address = address;
     d->port = port;
+    d->closed = false;
     d->thread = new std::thread([&]() { d->run(); });
     d->next_state = SocketState::Opening;
 }
 
 void Socket::close()
 {
-    if(d->state == SocketState::Initial)
+    std::lock_guard<std::mutex> lifecycle_lock(d->lifecycle_mutex);
+    // A socket that was just started is still in initial state until its thread picks up the next state.
+    if(d->state == SocketState::Initial && !d->thread)
     {
         d->error(ErrorCode::InvalidStateError, "Cannot close a socket in initial state");
         return;
     }
 
+    d->closed = true;
+
     if(d->state == SocketState::Closed || d->state == SocketState::Error)
     {
         // Silently ignore this, as calling close on an already closed socket should be fine.
+        // The thread may still need to be joined when the socket closed because of an error.
         d->state = SocketState::Closed;
-        d->message_received_condition_variable.notify_all();
+        if(d->thread)
+        {
+            d->thread->join();
+            delete d->thread;
+            d->thread = nullptr;
+        }
+        d->notifyReceiveQueues();
         return;
     }
 
@@ -202,6 +411,9 @@ void Socket::close()
         // We are still in an unconnected state but want to abort any connection
         // attempt. So disable any communication on the socket to make sure calls
         // like accept() exit, then close the socket.
+        // A connection that is established meanwhile is closed again, see Socket::Private::run().
+        std::lock_guard<std::mutex> lock(d->write_mutex);
+        d->connection_writable = false;
         d->platform_socket.shutdown(PlatformSocket::ShutdownDirection::ShutdownBoth);
         d->platform_socket.close();
         d->next_state = SocketState::Closed;
@@ -215,53 +427,283 @@ void Socket::close()
     }
     // Notify all in case of closing because the waiting threads need to know
     // that this socket has been closed and they should not wait any more.
-    d->message_received_condition_variable.notify_all();
+    d->notifyReceiveQueues();
 }
 
-void Socket::sendMessage(MessagePtr message)
+SendHandle Socket::sendMessage(MessagePtr message)
 {
     if(!message)
     {
         d->error(ErrorCode::InvalidMessageError, "Message cannot be nullptr");
-        return;
+        return SendHandle();
     }
 
-    std::lock_guard<std::mutex> lock(d->sendQueueMutex);
-    d->sendQueue.push_back(message);
+    MessagePriority::MessagePriority priority = MessagePriority::Normal;
+    {
+        std::lock_guard<std::mutex> lock(d->sendQueueMutex);
+        auto type_priority = d->message_type_priorities.find(d->message_types.getMessageTypeId(message));
+        if(type_priority != d->message_type_priorities.end())
+        {
+            priority = type_priority->second;
+        }
+    }
+
+    return sendMessage(message, priority);
 }
 
-MessagePtr Socket::takeNextMessage()
+SendHandle Socket::sendMessage(MessagePtr message, MessagePriority::MessagePriority priority)
 {
-    std::unique_lock<std::mutex> lk(d->receiveQueueMutexBlock);
+    if(!message)
+    {
+        d->error(ErrorCode::InvalidMessageError, "Message cannot be nullptr");
+        return SendHandle();
+    }
 
-    // Take the next message in the receive queue if available.
+    int time_to_live = 0;
     {
-        std::lock_guard<std::mutex> lock(d->receiveQueueMutex);
-        if(d->receiveQueue.size() > 0)
+        std::lock_guard<std::mutex> lock(d->sendQueueMutex);
+        auto type_time_to_live = d->message_type_time_to_live.find(d->message_types.getMessageTypeId(message));
+        if(type_time_to_live != d->message_type_time_to_live.end())
         {
-            MessagePtr next = d->receiveQueue.front();
-            d->receiveQueue.pop_front();
-            return next;
+            time_to_live = type_time_to_live->second;
         }
     }
 
-    // For a blocking call, wait until the receive queue available signal gets triggered and fetch the first message
-    // in the receive queue.
-    // Note that wait causes the current thread to block until the condition variable is notified or a spurious wakeup
-    // occurs, optionally looping until some predicate is satisfied. See https://en.cppreference.com/w/cpp/thread/condition_variable/wait
-    d->message_received_condition_variable.wait(lk);
+    return sendMessage(message, priority, time_to_live);
+}
+
+SendHandle Socket::sendMessage(MessagePtr message, MessagePriority::MessagePriority priority, int time_to_live)
+{
+    if(!message)
+    {
+        d->error(ErrorCode::InvalidMessageError, "Message cannot be nullptr");
+        return SendHandle();
+    }
+
+    // Priorities converted from integers may be out of range, the send queue only has a queue for each valid one.
+    const int priority_value = priority;
+    if(priority_value < MessagePriority::High || priority_value > MessagePriority::Low)
+    {
+        priority = priority_value < MessagePriority::High ? MessagePriority::High : MessagePriority::Low;
+    }
+
+    auto outgoing = std::make_shared<OutgoingMessage>(message, priority, time_to_live);
+
+    // Messages of datagram types skip the send queue, so they are not held up behind other messages.
+    if(d->datagram_active && d->sendDatagram(outgoing))
+    {
+        return SendHandle(outgoing);
+    }
+
+    if(d->direct_write && d->writeDirectly(outgoing))
+    {
+        return SendHandle(outgoing);
+    }
+
+    std::lock_guard<std::mutex> lock(d->sendQueueMutex);
+    d->sendQueue.push(outgoing);
+    return SendHandle(outgoing);
+}
+
+bool Socket::setMessageTypePriority(const std::string& type_name, MessagePriority::MessagePriority priority)
+{
+    MessagePtr message = d->message_types.createMessage(type_name);
+    if(!message)
+    {
+        d->error(ErrorCode::UnknownMessageTypeError, "Unknown message type " + type_name);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(d->sendQueueMutex);
+    d->message_type_priorities[d->message_types.getMessageTypeId(message)] = priority;
+    return true;
+}
+
+bool Socket::setMessageTypeTimeToLive(const std::string& type_name, int time_to_live)
+{
+    MessagePtr message = d->message_types.createMessage(type_name);
+    if(!message)
+    {
+        d->error(ErrorCode::UnknownMessageTypeError, "Unknown message type " + type_name);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(d->sendQueueMutex);
+    d->message_type_time_to_live[d->message_types.getMessageTypeId(message)] = std::max(time_to_live, 0);
+    return true;
+}
+
+bool Socket::setMessageTypeQueue(const std::string& type_name, const std::string& queue_name)
+{
+    if(d->state != SocketState::Initial)
+    {
+        d->error(ErrorCode::InvalidStateError, "Socket is not in initial state");
+        return false;
+    }
+
+    MessagePtr message = d->message_types.createMessage(type_name);
+    if(!message)
+    {
+        d->error(ErrorCode::UnknownMessageTypeError, "Unknown message type " + type_name);
+        return false;
+    }
+
+    uint32_t type_id = d->message_types.getMessageTypeId(message);
+    if(queue_name.empty())
+    {
+        d->message_type_queues.erase(type_id);
+        return true;
+    }
+
+    auto& queue = d->named_receive_queues[queue_name];
+    if(!queue)
+    {
+        queue.reset(new Private::ReceiveQueue());
+    }
+    d->message_type_queues[type_id] = queue.get();
+    return true;
+}
+
+bool Socket::setMessageTypeDatagram(const std::string& type_name, bool enabled)
+{
+    MessagePtr message = d->message_types.createMessage(type_name);
+    if(!message)
+    {
+        d->error(ErrorCode::UnknownMessageTypeError, "Unknown message type " + type_name);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(d->sendQueueMutex);
+    if(enabled)
+    {
+        d->datagram_types.insert(d->message_types.getMessageTypeId(message));
+    }
+    else
+    {
+        d->datagram_types.erase(d->message_types.getMessageTypeId(message));
+    }
+    return true;
+}
 
-    // Only continue to fetch the next message if the socket is still operating normally.
-    bool continue_to_take_next = d->state != SocketState::Closed && d->state != SocketState::Error;
+SocketStatistics Socket::getStatistics() const
+{
+    SocketStatistics statistics;
+    statistics.messages_sent = d->messages_sent;
+    statistics.messages_received = d->messages_received;
+    statistics.messages_cancelled = d->messages_cancelled;
+    statistics.messages_expired = d->messages_expired;
+    statistics.messages_dropped = d->messages_dropped;
+    statistics.bytes_sent = d->bytes_sent;
+    statistics.bytes_received = d->bytes_received;
+    return statistics;
+}
 
-    lk.unlock();
+MessagePtr Socket::takeNextMessage()
+{
+    return d->takeReceivedMessage(d->receive_queue);
+}
 
-    MessagePtr result;  // null by default
-    if (continue_to_take_next)
+MessagePtr Socket::takeNextMessage(const std::string& queue_name)
+{
+    auto queue = d->named_receive_queues.find(queue_name);
+    if(queue == d->named_receive_queues.end())
     {
-        result = takeNextMessage();
+        d->error(ErrorCode::InvalidStateError, "Unknown receive queue " + queue_name);
+        return MessagePtr();
     }
-    return result;
+
+    return d->takeReceivedMessage(*queue->second);
+}
+
+void Socket::addSocketSet(const std::shared_ptr<Arcus::Private::SocketSetState>& set)
+{
+    std::lock_guard<std::mutex> lock(d->socket_sets_mutex);
+    d->socket_sets.push_back(set);
+}
+
+void Socket::removeSocketSet(const std::shared_ptr<Arcus::Private::SocketSetState>& set)
+{
+    std::lock_guard<std::mutex> lock(d->socket_sets_mutex);
+    d->socket_sets.erase(std::remove(d->socket_sets.begin(), d->socket_sets.end(), set), d->socket_sets.end());
+}
+
+bool Socket::hasPendingMessages() const
+{
+    std::lock_guard<std::mutex> lock(d->receive_queue.mutex);
+    return !d->receive_queue.messages.empty();
+}
+
+MessagePtr Socket::takePendingMessage()
+{
+    std::lock_guard<std::mutex> lock(d->receive_queue.mutex);
+    if(d->receive_queue.messages.empty())
+    {
+        return MessagePtr();
+    }
+
+    return d->popReceivedMessage(d->receive_queue);
+}
+
+bool Socket::reconnect(const std::string& address, int port)
+{
+    // Not done while close() is in progress, which would otherwise join the thread of the socket concurrently.
+    std::lock_guard<std::mutex> lifecycle_lock(d->lifecycle_mutex);
+    if(d->closed || (d->state != SocketState::Closed && d->state != SocketState::Error))
+    {
+        return false;
+    }
+
+    reset();
+    connect(address, port);
+    return true;
+}
+
+bool Socket::wasClosed() const
+{
+    return d->closed;
+}
+
+bool Socket::takeOverMessage(const SendHandle& handle)
+{
+    // The message stays in the queue of its previous socket, which skips it once this socket has taken it.
+    if(!handle._message || handle._message->status != SendStatus::Queued)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(d->sendQueueMutex);
+    d->sendQueue.push(handle._message);
+    return true;
+}
+
+MessagePtr Socket::takeNextStreamedMessage()
+{
+    std::lock_guard<std::mutex> lock(d->streamedQueueMutex);
+    if(d->streamedQueue.empty())
+    {
+        return MessagePtr();
+    }
+
+    MessagePtr next = d->streamedQueue.front().message;
+    d->streamedQueue.pop_front();
+    return next;
+}
+
+MessagePtr Socket::takeNextStreamedMessage(uint32_t& type_id, int& field_number, uint64_t& sequence)
+{
+    std::lock_guard<std::mutex> lock(d->streamedQueueMutex);
+    if(d->streamedQueue.empty())
+    {
+        return MessagePtr();
+    }
+
+    const Private::StreamedElement& next = d->streamedQueue.front();
+    MessagePtr message = next.message;
+    type_id = next.type_id;
+    field_number = next.field_number;
+    sequence = next.sequence;
+    d->streamedQueue.pop_front();
+    return message;
 }
 
 MessagePtr Arcus::Socket::createMessage(const std::string& type)
@@ -23,11 +23,20 @@
 
 #include "Types.h"
 #include "Error.h"
+#include "SendHandle.h"
 #include "ArcusExport.h"
 
 namespace Arcus
 {
     class SocketListener;
+    class MessageHandler;
+    class SocketSet;
+    class SocketPool;
+
+    namespace Private
+    {
+        class SocketSetState;
+    }
 
     /**
      * \brief Threaded socket class.
@@ -65,7 +74,9 @@ namespace Arcus
         /**
          * Register a new type of Message to handle.
          *
-         * If the socket state is not SocketState::Initial, this method will do nothing.
+         * Types can be registered at any time, also while the socket is connected. Types registered
+         * after connecting are sent in regular frames instead of compact frames, since they are not in
+         * the table of types exchanged when the connection was made.
          *
          * \param message_type An instance of the Message that will be used as factory object.
          *
@@ -75,17 +86,38 @@ namespace Arcus
         /**
          * Register all message types contained in a Protobuf protocol description file.
          *
-         * If the socket state is not SocketState::Initial, this method will do nothing.
+         * Like registerMessageType(), this can be done at any time.
          *
          * \param file_name The absolute path to a Protobuf protocol file to load message types from.
          */
         virtual bool registerAllMessageTypes(const std::string& file_name);
 
         /**
-         * Add a listener object that will be notified of socket events.
+         * Deliver the elements of a repeated message field while the containing message is still arriving.
+         *
+         * After registration, each element of the field is parsed and put on the streamed message queue
+         * as soon as its bytes have been received, instead of only becoming available once the entire
+         * message has arrived. The complete message is still delivered through takeNextMessage().
+         *
+         * When frame checksums are used, the elements of a message are only delivered once the checksum
+         * of the message has been verified. Elements of a chunked message that the sender cancels, see
+         * SendHandle::cancel(), may have been delivered already, while the message itself is not.
          *
          * If the socket state is not SocketState::Initial, this method will do nothing.
          *
+         * \param type_name The type name of a registered message type.
+         * \param field_name The name of a top-level repeated message field of that type.
+         *
+         * \return true if registration was successful, false if not.
+         */
+        virtual bool registerStreamedField(const std::string& type_name, const std::string& field_name);
+
+        /**
+         * Add a listener object that will be notified of socket events.
+         *
+         * Listeners can be added at any time, also while the socket is connected.
+         * The socket takes ownership of the listener.
+         *
          * \param listener The listener to add.
          */
         void addListener(SocketListener* listener);
@@ -93,16 +125,247 @@ namespace Arcus
         /**
          * Remove a listener from the list of listeners.
          *
-         * If the socket state is not SocketState::Initial, this method will do nothing.
+         * Listeners can be removed at any time. Once this returns, the listener is no longer
+         * notified and ownership of it passes back to the caller. When called from a
+         * notification of this socket, notifications in progress on other threads may still
+         * reach it. Otherwise this waits for those notifications, so two sockets whose
+         * listeners remove each other's listeners at the same time wait for each other.
          *
          * \param listener The listener to remove.
          */
         void removeListener(SocketListener* listener);
 
+        /**
+         * Pass received messages to a handler on a thread pool instead of putting them on the receive queue.
+         *
+         * Messages with the same key are handled in the order they were received, messages with
+         * different keys are handled at the same time, see setMessageKeyField(). Messages of types
+         * without a key field are handled in the order they were received as well. Listeners are not
+         * notified through SocketListener::messageReceived() of messages passed to the handler.
+         *
+         * The socket waits for the handler to finish with its messages when it is destroyed, so the
+         * handler must not destroy the socket. Exceptions thrown by the handler are reported as errors
+         * to the listeners of the socket.
+         *
+         * If the socket state is not SocketState::Initial, this method will do nothing.
+         *
+         * \param handler The handler, or nullptr to use the receive queue. The socket does not take ownership of it.
+         */
+        void setMessageHandler(MessageHandler* handler);
+
+        /**
+         * Set the field of a message type that holds the key of its messages for the message handler.
+         *
+         * Messages with the same value in their key fields are handled in order, even when they are
+         * of different types. This is for example the ID of the object the message is about.
+         *
+         * If the socket state is not SocketState::Initial, this method will do nothing.
+         *
+         * \param type_name The type name of a registered message type.
+         * \param field_name The name of a top-level integer, enum or string field of that type.
+         *
+         * \return true if the key field was set, false if not.
+         */
+        bool setMessageKeyField(const std::string& type_name, const std::string& field_name);
+
+        /**
+         * Set the amount of threads that run message handlers of all sockets in the process.
+         *
+         * This only has an effect before the first message is passed to a handler.
+         *
+         * \param count The amount of threads, or 0 for one per processor. Defaults to 0.
+         */
+        static void setMessageHandlerThreadCount(int count);
+
+        /**
+         * Get the amount of threads that run message handlers of all sockets in the process.
+         */
+        static int getMessageHandlerThreadCount();
+
+        /**
+         * Set how often listeners are notified of the progress of large messages.
+         *
+         * Progress is reported through SocketListener::receiveProgress() and
+         * SocketListener::sendProgress() for messages of at least one MiB.
+         *
+         * \param interval The minimum time in milliseconds between two progress
+         * notifications for the same message, or 0 to disable progress reporting.
+         */
+        void setProgressInterval(int interval);
+
+        /**
+         * Set the size from which messages are sent as chunked frames.
+         *
+         * The data of a chunked frame is sent in separately framed chunks, so a
+         * message that is cancelled while it is being sent can be aborted without
+         * sending the rest of its data. The peer must be using a version of libArcus
+         * that supports chunked frames.
+         *
+         * \param minimum_size The minimum size of a message in bytes to send it as
+         * chunked frame, or 0 to never use chunked frames. Defaults to 0.
+         */
+        void setChunkedFrameSize(uint32_t minimum_size);
+
+        /**
+         * Send small messages together in batch frames.
+         *
+         * Messages that fit in a batch are collected for at most max_delay milliseconds
+         * or until max_size bytes have been collected, and are then sent together as one
+         * frame. The receiving side queues the messages of a batch in order. The peer must
+         * be using a version of libArcus that supports batch frames.
+         *
+         * \param max_delay The maximum time in milliseconds a message is held back to be
+         * batched with others. With 0, only messages that are already queued are batched.
+         * \param max_size The maximum size of a batch in bytes, or 0 to disable batching.
+         * Defaults to 0.
+         */
+        void setBatching(int max_delay, uint32_t max_size);
+
+        /**
+         * Send messages in compact frames when the peer supports them.
+         *
+         * When enabled, the socket exchanges a handshake with its peer after connecting.
+         * Once the handshake of the peer has been received, messages are sent in frames
+         * with a one-byte tag, a varint size and a short type index instead of the 12-byte
+         * header. A peer that does not support compact frames reports the handshake as an
+         * unknown message type and keeps receiving regular frames.
+         *
+         * \param enabled Whether to use compact frames. Defaults to false.
+         */
+        void setCompactFrames(bool enabled);
+
+        /**
+         * Send frames with a sync marker and CRC32C checksums when the peer supports them.
+         *
+         * Support is negotiated using the same handshake as compact frames. The header and the
+         * data of each frame are followed by their checksum. A message with corrupted data is
+         * dropped, and after a corrupted header the receiving side skips ahead to the next sync
+         * marker, so a corrupted frame only costs the message it contained.
+         *
+         * \param enabled Whether to send frames with checksums. Defaults to false.
+         */
+        void setFrameChecksums(bool enabled);
+
+        /**
+         * Set the maximum time to wait for a connection attempt.
+         *
+         * \param timeout The maximum time in milliseconds to wait for a connection to be
+         * established, or 0 to wait as long as the platform does. Defaults to 0.
+         */
+        void setConnectTimeout(int timeout);
+
+        /**
+         * Retry failed connection attempts.
+         *
+         * When the peer is not listening yet, connect() keeps trying to connect until retry_time
+         * has passed, instead of going into the SocketState::Error state after the first attempt.
+         * The delay between attempts starts at initial_delay and doubles with every attempt, up to
+         * maximum_delay. Listeners are notified through SocketListener::stateChanged() as soon as
+         * the connection has been established.
+         *
+         * \param retry_time The time in milliseconds during which failed attempts are retried, or
+         * 0 to not retry. Defaults to 0.
+         * \param initial_delay The delay in milliseconds after the first failed attempt. Defaults to 10.
+         * \param maximum_delay The maximum delay in milliseconds between attempts. Defaults to 500.
+         */
+        void setConnectRetry(int retry_time, int initial_delay, int maximum_delay);
+
+        /**
+         * Use TCP Fast Open where the platform supports it.
+         *
+         * For listening sockets this accepts Fast Open connections. For connecting sockets this sends
+         * the first data together with the connection request when connecting to a known server again.
+         *
+         * \param enabled Whether to use TCP Fast Open. Defaults to false.
+         */
+        void setFastOpen(bool enabled);
+
+        /**
+         * Let the thread calling sendMessage() write the message to the connection itself when possible.
+         *
+         * This avoids waiting for the socket thread to pick up the message. It is done for messages
+         * smaller than 256 KiB when no other messages are waiting to be sent and the socket thread is
+         * not writing. Otherwise, and when the send buffer of the connection is full, the message is
+         * queued as usual. When only part of the message fits the send buffer, the socket thread
+         * writes the rest, so sendMessage() never waits for room in the send buffer. Batching,
+         * chunked frames and send rate limits take precedence.
+         *
+         * \param enabled Whether messages can be written directly. Defaults to false.
+         */
+        void setDirectWrite(bool enabled);
+
+        /**
+         * Open a datagram side channel next to the connection when the peer supports it.
+         *
+         * Support is negotiated using the same handshake as compact frames, and both sides need to
+         * enable the channel. It is only available for TCP connections. Messages of the types set
+         * with setMessageTypeDatagram() are then sent as single UDP datagrams, which are not held
+         * up by other messages but may be lost or arrive out of order.
+         *
+         * \param enabled Whether to open a datagram channel. Defaults to false.
+         */
+        void setDatagramChannel(bool enabled);
+
+        /**
+         * Set the options of the network connection.
+         *
+         * The options are applied to the connection made by the next call to connect()
+         * or listen(). If the socket state is not SocketState::Initial, this method will
+         * do nothing.
+         *
+         * \param options The options to use.
+         *
+         * \return true if the options were set, false if not.
+         */
+        bool setOptions(const SocketOptions& options);
+
+        /**
+         * Get the options of the network connection.
+         */
+        SocketOptions getOptions() const;
+
+        /**
+         * Limit the total rate at which all sockets in the process send data.
+         *
+         * The sockets that are sending at the same time share the total rate in proportion
+         * to the send_weight in their options, so a socket sending a large message does not
+         * hold up the others. The send_rate in the options of a socket limits it further.
+         *
+         * \param bytes_per_second The maximum total rate, or 0 for no limit. Defaults to 0.
+         */
+        static void setTotalSendRate(uint64_t bytes_per_second);
+
+        /**
+         * Get the total rate at which all sockets in the process may send data, or 0 if there is no limit.
+         */
+        static uint64_t getTotalSendRate();
+
+        /**
+         * Limit the total memory all sockets in the process use for received data.
+         *
+         * This covers the messages being received and the received messages waiting to be taken.
+         * When most of it is in use, sockets using more than an equal share of it stop reading
+         * until their messages are taken, so a peer sending large messages does not hold up the
+         * others. The receive_memory_limit in the options of a socket limits it further.
+         *
+         * \param bytes The maximum total amount of memory, or 0 for no limit. Defaults to 0.
+         */
+        static void setTotalReceiveMemoryLimit(uint64_t bytes);
+
+        /**
+         * Get the total memory all sockets in the process may use for received data, or 0 if there is no limit.
+         */
+        static uint64_t getTotalReceiveMemoryLimit();
+
+        /**
+         * Get the memory this socket currently uses for received data, in bytes.
+         */
+        uint64_t getReceiveMemoryUsage() const;
+
         /**
          * Connect to an address and port.
          *
-         * \param address The IP address to connect to.
+         * \param address The host name or IPv4 or IPv6 address to connect to.
          * \param port The port to connect to.
          */
         virtual void connect(const std::string& address, int port);
@@ -110,11 +373,37 @@ namespace Arcus
         /**
          * Listen for connections on an address and port.
          *
-         * \param address The IP address to listen on.
+         * \param address The host name or IPv4 or IPv6 address to listen on.
          * \param port The port to listen on.
          */
         virtual void listen(const std::string& address, int port);
 
+        /**
+         * Use an already connected socket.
+         *
+         * The socket takes ownership of the file descriptor and closes it when the connection is closed.
+         * This can be used with a file descriptor created by createSocketPair() or inherited from a
+         * parent process, in which case no port needs to be listened on.
+         *
+         * \param fd The file descriptor or socket handle of a connected stream socket.
+         */
+        virtual void adoptFd(int fd);
+
+        /**
+         * Create a pair of connected sockets for communicating with a child process.
+         *
+         * The child end is inherited by child processes, so its number can be passed to a child
+         * that calls adoptFd() with it. The parent end is not inherited, and can be passed to
+         * adoptFd() of a socket in this process. After starting the child, the parent should close
+         * its copy of the child end, so the connection closes when the child exits.
+         *
+         * \param parent_fd Set to the file descriptor of the end for this process.
+         * \param child_fd Set to the file descriptor of the end for the child process.
+         *
+         * \return true if the pair was created, false if not.
+         */
+        static bool createSocketPair(int& parent_fd, int& child_fd);
+
         /**
          * Close the connection and stop handling any messages.
          */
@@ -127,14 +416,148 @@ namespace Arcus
 
         /**
          * Send a message across the socket.
+         *
+         * The message is sent with the priority and time to live set for its type using
+         * setMessageTypePriority() and setMessageTypeTimeToLive(). By default messages are
+         * sent with MessagePriority::Normal and without deadline.
+         *
+         * \param message The message to send.
+         *
+         * \return A handle that can be used to follow or cancel sending the message.
+         */
+        virtual SendHandle sendMessage(MessagePtr message);
+
+        /**
+         * Send a message across the socket with a specific priority.
+         *
+         * The message is sent with the time to live set for its type.
+         *
+         * \param message The message to send.
+         * \param priority The priority class of the message. Values outside the range of MessagePriority are clamped to it.
+         *
+         * \return A handle that can be used to follow or cancel sending the message.
+         */
+        virtual SendHandle sendMessage(MessagePtr message, MessagePriority::MessagePriority priority);
+
+        /**
+         * Send a message across the socket with a specific priority and deadline.
+         *
+         * \param message The message to send.
+         * \param priority The priority class of the message. Values outside the range of MessagePriority are clamped to it.
+         * \param time_to_live The time in milliseconds after which the message is dropped
+         * if it has not started sending yet, or 0 to always send it.
+         *
+         * \return A handle that can be used to follow or cancel sending the message.
          */
-        virtual void sendMessage(MessagePtr message);
+        virtual SendHandle sendMessage(MessagePtr message, MessagePriority::MessagePriority priority, int time_to_live);
+
+        /**
+         * Set the default priority of messages of a certain type.
+         *
+         * \param type_name The type name of a registered message type.
+         * \param priority The priority class messages of this type are sent with by default.
+         *
+         * \return true if the priority was set, false if the message type is unknown.
+         */
+        bool setMessageTypePriority(const std::string& type_name, MessagePriority::MessagePriority priority);
+
+        /**
+         * Set the default time to live of messages of a certain type.
+         *
+         * Messages that are still queued when their time to live has passed are
+         * dropped without being serialized, with status SendStatus::Expired.
+         *
+         * \param type_name The type name of a registered message type.
+         * \param time_to_live The time in milliseconds after which messages of this
+         * type are dropped if they have not started sending, or 0 to always send them.
+         *
+         * \return true if the time to live was set, false if the message type is unknown.
+         */
+        bool setMessageTypeTimeToLive(const std::string& type_name, int time_to_live);
+
+        /**
+         * Put received messages of a certain type on a receive queue of their own.
+         *
+         * Messages on a separate queue are taken with takeNextMessage(queue_name), so a thread that
+         * only handles some message types does not have to take the other messages and pass them on.
+         * Several types can share a queue, and several threads can take messages from the same queue.
+         *
+         * If the socket state is not SocketState::Initial, this method will do nothing.
+         *
+         * \param type_name The type name of a registered message type.
+         * \param queue_name The name of the queue, or an empty string for the default queue.
+         *
+         * \return true if the queue was set, false if the message type is unknown.
+         */
+        bool setMessageTypeQueue(const std::string& type_name, const std::string& queue_name);
+
+        /**
+         * Send messages of a certain type over the datagram channel.
+         *
+         * While a datagram channel is open, messages of this type are sent right away as a datagram,
+         * without waiting in the send queue. If the datagram cannot be sent without blocking it is
+         * dropped, with status SendStatus::Dropped. Messages that are too large for a single datagram,
+         * and all messages while no datagram channel is open, are sent over the connection as usual.
+         *
+         * \param type_name The type name of a registered message type.
+         * \param enabled Whether to send messages of this type as datagrams.
+         *
+         * \return true if the type was changed, false if the message type is unknown.
+         *
+         * \see setDatagramChannel()
+         */
+        bool setMessageTypeDatagram(const std::string& type_name, bool enabled);
+
+        /**
+         * Get the traffic statistics of this socket.
+         */
+        SocketStatistics getStatistics() const;
 
         /**
          * Remove and return the next pending message from the queue with condition blocking.
+         *
+         * \return The next message, or an invalid pointer if the socket has closed.
          */
         virtual MessagePtr takeNextMessage();
 
+        /**
+         * Remove and return the next message from a queue set with setMessageTypeQueue(), waiting until there is one.
+         *
+         * \param queue_name The name of the queue.
+         *
+         * \return The next message, or an invalid pointer if the socket has closed or the queue does not exist.
+         */
+        MessagePtr takeNextMessage(const std::string& queue_name);
+
+        /**
+         * Remove and return the next element of a streamed field without blocking.
+         *
+         * Elements are returned in the order they were received.
+         *
+         * \return The next element or an invalid pointer if there are no pending elements.
+         *
+         * \see registerStreamedField()
+         */
+        virtual MessagePtr takeNextStreamedMessage();
+
+        /**
+         * Remove and return the next element of a streamed field without blocking, along with the message it is part of.
+         *
+         * Elements are returned in the order they were received. The elements of one message have the same
+         * sequence number, which increases by one for every message whose elements are streamed, so elements
+         * of different messages or fields can be told apart.
+         *
+         * \param type_id Set to the type ID of the message the element is part of.
+         * \param field_number Set to the number of the field the element is part of.
+         * \param sequence Set to the sequence number of the message the element is part of, starting at 1.
+         *
+         * \return The next element or an invalid pointer if there are no pending elements, in which case
+         * the other values are not changed.
+         *
+         * \see registerStreamedField()
+         */
+        MessagePtr takeNextStreamedMessage(uint32_t& type_id, int& field_number, uint64_t& sequence);
+
         /**
          * Create an instance of a Message class.
          *
@@ -143,6 +566,19 @@ namespace Arcus
         virtual MessagePtr createMessage(const std::string& type_name);
 
     private:
+        // So sets can follow the events of their sockets and take their messages without blocking.
+        friend class SocketSet;
+        // So pools can move queued messages of a failed socket to another one and connect it again.
+        friend class SocketPool;
+
+        void addSocketSet(const std::shared_ptr<Arcus::Private::SocketSetState>& set);
+        void removeSocketSet(const std::shared_ptr<Arcus::Private::SocketSetState>& set);
+        bool hasPendingMessages() const;
+        MessagePtr takePendingMessage();
+        bool takeOverMessage(const SendHandle& handle);
+        bool reconnect(const std::string& address, int port);
+        bool wasClosed() const;
+
         // Copy and assignment is not supported.
         Socket(const Socket&);
         Socket& operator=(const Socket& other);
@@ -66,6 +66,37 @@ namespace Arcus
          * on a receive queue so other threads can take care of it.
          */
         virtual void messageReceived() = 0;
+        /**
+         * Called whenever one or more elements of a streamed field have been
+         * received and correctly parsed.
+         *
+         * The elements can be retrieved with Socket::takeNextStreamedMessage(). With frame
+         * checksums, this is only called once the whole message has been received and verified.
+         * The default implementation does nothing.
+         */
+        virtual void streamedMessageReceived() { }
+        /**
+         * Called periodically while a large message is being received.
+         *
+         * This is only called when progress reporting has been enabled with
+         * Socket::setProgressInterval(). The default implementation does nothing.
+         *
+         * \param type_id The type ID of the message being received.
+         * \param received_size The amount of bytes of the message received so far.
+         * \param total_size The total size of the message in bytes.
+         */
+        virtual void receiveProgress(uint32_t /*type_id*/, uint32_t /*received_size*/, uint32_t /*total_size*/) { }
+        /**
+         * Called periodically while a large message is being sent.
+         *
+         * This is only called when progress reporting has been enabled with
+         * Socket::setProgressInterval(). The default implementation does nothing.
+         *
+         * \param type_id The type ID of the message being sent.
+         * \param sent_size The amount of bytes of the message sent so far.
+         * \param total_size The total size of the message in bytes.
+         */
+        virtual void sendProgress(uint32_t /*type_id*/, uint32_t /*sent_size*/, uint32_t /*total_size*/) { }
         /**
          * Called whenever an error occurs on the socket.
          *
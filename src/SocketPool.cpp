@@ -0,0 +1,306 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SocketPool.h"
+#include "SocketPool_p.h"
+#include "Socket.h"
+
+#include <google/protobuf/message.h>
+
+using namespace Arcus;
+
+SocketPool::SocketPool() : d(new Private)
+{
+    d->monitor = new std::thread([this]() { monitor(); });
+}
+
+SocketPool::~SocketPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(d->events->mutex);
+        d->stopping = true;
+        d->events->condition_variable.notify_all();
+    }
+    d->monitor->join();
+    delete d->monitor;
+
+    // The sockets are marked as busy so they are not destroyed before they stopped reporting to the pool.
+    std::unique_lock<std::mutex> lock(d->events->mutex);
+    std::vector<Socket*> sockets = d->events->sockets;
+    d->events->busy = sockets;
+    lock.unlock();
+
+    for(Socket* socket : sockets)
+    {
+        socket->removeSocketSet(d->events);
+    }
+
+    lock.lock();
+    d->events->busy.clear();
+    d->events->condition_variable.notify_all();
+}
+
+void SocketPool::setRoutingPolicy(RoutingPolicy::RoutingPolicy policy)
+{
+    d->policy = policy;
+}
+
+RoutingPolicy::RoutingPolicy SocketPool::getRoutingPolicy() const
+{
+    return d->policy;
+}
+
+void SocketPool::setReconnectDelay(int delay)
+{
+    d->reconnect_delay = std::max(delay, 0);
+}
+
+bool SocketPool::addSocket(Socket* socket, const std::string& address, int port)
+{
+    if(!socket || socket->getState() != SocketState::Initial)
+    {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(d->events->mutex);
+        d->removeDestroyedMembers();
+        for(const Private::Member& member : d->members)
+        {
+            if(member.socket == socket)
+            {
+                return false;
+            }
+        }
+
+        Private::Member member;
+        member.socket = socket;
+        member.address = address;
+        member.port = port;
+        member.pending_bytes = 0;
+        d->members.push_back(member);
+        d->events->sockets.push_back(socket);
+        d->buildRing();
+    }
+
+    // Not done with the pool locked, since the socket holds its own lock while reporting to the pool.
+    socket->addSocketSet(d->events);
+    socket->connect(address, port);
+    return true;
+}
+
+void SocketPool::removeSocket(Socket* socket)
+{
+    {
+        std::unique_lock<std::mutex> lock(d->events->mutex);
+        d->removeDestroyedMembers();
+        auto position = std::find_if(d->members.begin(), d->members.end(), [socket](const Private::Member& member)
+        {
+            return member.socket == socket;
+        });
+
+        if(position == d->members.end())
+        {
+            return;
+        }
+
+        d->members.erase(position);
+        d->buildRing();
+
+        // The monitor thread may be connecting the socket again.
+        d->waitUntilIdle(lock, socket);
+        auto& sockets = d->events->sockets;
+        sockets.erase(std::remove(sockets.begin(), sockets.end(), socket), sockets.end());
+        auto& ready = d->events->ready;
+        ready.erase(std::remove(ready.begin(), ready.end(), socket), ready.end());
+    }
+
+    // Not done with the pool locked, since the socket holds its own lock while reporting to the pool.
+    socket->removeSocketSet(d->events);
+}
+
+std::vector<Socket*> SocketPool::getSockets() const
+{
+    std::lock_guard<std::mutex> lock(d->events->mutex);
+    d->removeDestroyedMembers();
+    std::vector<Socket*> sockets;
+    for(const Private::Member& member : d->members)
+    {
+        sockets.push_back(member.socket);
+    }
+    return sockets;
+}
+
+SendHandle SocketPool::sendMessage(MessagePtr message)
+{
+    return sendMessage(message, std::string());
+}
+
+SendHandle SocketPool::sendMessage(MessagePtr message, const std::string& key)
+{
+    if(!message)
+    {
+        return SendHandle();
+    }
+
+    std::lock_guard<std::mutex> lock(d->events->mutex);
+    d->removeDestroyedMembers();
+    checkSockets();
+
+    int index = route(key);
+    if(index < 0)
+    {
+        return SendHandle();
+    }
+
+    Private::Member& member = d->members[index];
+
+    Private::PendingMessage pending;
+    pending.handle = member.socket->sendMessage(message);
+    pending.key = key;
+    pending.size = d->policy != RoutingPolicy::LeastQueued ? message->ByteSizeLong() : 0;
+
+    member.pending.push_back(pending);
+    member.pending_bytes += pending.size;
+    return pending.handle;
+}
+
+// Choose the member to send a message with, or -1 if no member is connected.
+int SocketPool::route(const std::string& key) const
+{
+    auto is_connected = [this](std::size_t index)
+    {
+        return d->members[index].socket->getState() == SocketState::Connected;
+    };
+
+    if(d->policy == RoutingPolicy::ConsistentHash && !key.empty())
+    {
+        // Use the first connected member at or after the point of the key on the ring,
+        // so the keys of a member that is not connected move to the next member.
+        auto point = std::lower_bound(d->ring.begin(), d->ring.end(), std::make_pair(Arcus::Private::crc32c(key.data(), key.size()), std::size_t(0)));
+        for(std::size_t step = 0; step < d->ring.size(); ++step, ++point)
+        {
+            if(point == d->ring.end())
+            {
+                point = d->ring.begin();
+            }
+
+            if(is_connected(point->second))
+            {
+                return static_cast<int>(point->second);
+            }
+        }
+        return -1;
+    }
+
+    int best = -1;
+    uint64_t best_load = 0;
+    const std::size_t count = d->members.size();
+    for(std::size_t offset = 0; offset < count; ++offset)
+    {
+        // Start at a different member every time, so equally loaded members take turns.
+        const std::size_t index = (d->next_member + offset) % count;
+        if(!is_connected(index))
+        {
+            continue;
+        }
+
+        const Private::Member& member = d->members[index];
+        uint64_t load = d->policy == RoutingPolicy::LeastQueued ? member.pending.size() : member.pending_bytes;
+        if(best < 0 || load < best_load)
+        {
+            best = static_cast<int>(index);
+            best_load = load;
+        }
+    }
+
+    if(best >= 0)
+    {
+        d->next_member = best + 1;
+    }
+    return best;
+}
+
+// Move the queued messages of failed members to other members and schedule when failed members are connected again.
+void SocketPool::checkSockets()
+{
+    const auto now = std::chrono::steady_clock::now();
+    for(Private::Member& member : d->members)
+    {
+        Private::removeSentMessages(member);
+
+        // A socket closes when its backend shuts down, which is handled like a failure.
+        SocketState::SocketState state = member.socket->getState();
+        if(state != SocketState::Error && state != SocketState::Closed)
+        {
+            continue;
+        }
+
+        std::deque<Private::PendingMessage> pending;
+        pending.swap(member.pending);
+        member.pending_bytes = 0;
+        for(Private::PendingMessage& message : pending)
+        {
+            // Messages that cannot be moved stay with the failed member, which sends them once it is connected again.
+            int index = route(message.key);
+            Private::Member& target = index >= 0 ? d->members[index] : member;
+            if(index >= 0 && !target.socket->takeOverMessage(message.handle))
+            {
+                continue;
+            }
+
+            target.pending.push_back(message);
+            target.pending_bytes += message.size;
+        }
+
+        // Sockets closed by the application stay closed.
+        if(d->reconnect_delay <= 0 || member.socket->wasClosed())
+        {
+            continue;
+        }
+
+        if(member.reconnect_time == std::chrono::steady_clock::time_point())
+        {
+            member.reconnect_time = now + std::chrono::milliseconds(d->reconnect_delay);
+        }
+    }
+}
+
+// Check the members whenever the state of one changes and when a failed member is due to be connected again.
+void SocketPool::monitor()
+{
+    std::unique_lock<std::mutex> lock(d->events->mutex);
+    while(!d->stopping)
+    {
+        d->events->ready.clear();
+        d->removeDestroyedMembers();
+        checkSockets();
+        d->reconnectSockets(lock);
+
+        auto woken = [this]() { return !d->events->ready.empty() || d->stopping; };
+        std::chrono::steady_clock::time_point reconnect_time = d->getNextReconnectTime();
+        if(reconnect_time == std::chrono::steady_clock::time_point())
+        {
+            d->events->condition_variable.wait(lock, woken);
+        }
+        else
+        {
+            d->events->condition_variable.wait_until(lock, reconnect_time, woken);
+        }
+    }
+}
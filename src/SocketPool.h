@@ -0,0 +1,141 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCUS_SOCKET_POOL_H
+#define ARCUS_SOCKET_POOL_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Types.h"
+#include "SendHandle.h"
+#include "ArcusExport.h"
+
+namespace Arcus
+{
+    class Socket;
+
+    /**
+     * \brief A pool of connections to identical backends.
+     *
+     * Messages sent through the pool are spread across the sockets in it that are
+     * connected, according to the routing policy. When a socket goes into the
+     * SocketState::Error or SocketState::Closed state, the messages still queued on
+     * it are moved to the other sockets and the socket is connected again after the
+     * reconnect delay. This is done by a thread of the pool, so it also happens while no
+     * messages are being sent. Sockets closed with Socket::close() are not connected again.
+     *
+     * The pool does not take ownership of the sockets, and a socket that is destroyed
+     * is removed from the pool by itself. Received messages arrive on
+     * the sockets themselves, which can be added to a SocketSet to handle them together.
+     */
+    class ARCUS_EXPORT SocketPool
+    {
+    public:
+        SocketPool();
+        virtual ~SocketPool();
+
+        /**
+         * Set how the socket to send a message with is chosen.
+         *
+         * \param policy The routing policy. Defaults to RoutingPolicy::LeastBytes.
+         */
+        void setRoutingPolicy(RoutingPolicy::RoutingPolicy policy);
+
+        /**
+         * Get how the socket to send a message with is chosen.
+         */
+        RoutingPolicy::RoutingPolicy getRoutingPolicy() const;
+
+        /**
+         * Set the delay before a socket that failed or was closed by its peer is connected again.
+         *
+         * \param delay The delay in milliseconds, or 0 to not reconnect. Defaults to 1000.
+         */
+        void setReconnectDelay(int delay);
+
+        /**
+         * Add a socket to the pool and connect it to an endpoint.
+         *
+         * The socket should have its message types registered and be configured, but not be connected yet.
+         *
+         * \param socket The socket to add.
+         * \param address The host name or IPv4 or IPv6 address of the endpoint.
+         * \param port The port of the endpoint.
+         *
+         * \return true if the socket was added, false if it is not in the SocketState::Initial state
+         * or already in the pool.
+         */
+        bool addSocket(Socket* socket, const std::string& address, int port);
+
+        /**
+         * Remove a socket from the pool.
+         *
+         * The socket is not closed, and messages already queued on it are still sent by it.
+         *
+         * \param socket The socket to remove.
+         */
+        void removeSocket(Socket* socket);
+
+        /**
+         * Get the sockets in the pool.
+         */
+        std::vector<Socket*> getSockets() const;
+
+        /**
+         * Send a message with the socket chosen by the routing policy.
+         *
+         * With RoutingPolicy::ConsistentHash, messages sent without a key are routed
+         * as with RoutingPolicy::LeastBytes.
+         *
+         * \param message The message to send.
+         *
+         * \return A handle to the message, or an invalid handle if no socket in the pool is connected.
+         */
+        SendHandle sendMessage(MessagePtr message);
+
+        /**
+         * Send a message with the socket its key maps to.
+         *
+         * With RoutingPolicy::ConsistentHash, messages with the same key are sent with the
+         * same socket as long as it is connected, and adding or removing a socket only moves
+         * a small part of the keys to a different socket. The key is ignored by other policies.
+         *
+         * \param message The message to send.
+         * \param key The key of the message, such as the ID of the job it belongs to.
+         *
+         * \return A handle to the message, or an invalid handle if no socket in the pool is connected.
+         */
+        SendHandle sendMessage(MessagePtr message, const std::string& key);
+
+    private:
+        // Copy and assignment is not supported.
+        SocketPool(const SocketPool&);
+        SocketPool& operator=(const SocketPool& other);
+
+        int route(const std::string& key) const;
+        void checkSockets();
+        void monitor();
+
+        class Private;
+        const std::unique_ptr<Private> d;
+    };
+}
+
+#endif // ARCUS_SOCKET_POOL_H
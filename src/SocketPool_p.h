@@ -0,0 +1,218 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCUS_SOCKET_POOL_P_H
+#define ARCUS_SOCKET_POOL_P_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "SocketPool.h"
+#include "Socket.h"
+#include "SocketSet_p.h"
+#include "Crc32c_p.h"
+
+namespace Arcus
+{
+    /**
+     * Private implementation details for SocketPool.
+     */
+    class ARCUS_NO_EXPORT SocketPool::Private
+    {
+    public:
+        // A message sent through the pool that has not been sent completely yet.
+        struct PendingMessage
+        {
+            SendHandle handle;
+            // The key the message was sent with, to route it again when its socket fails.
+            std::string key;
+            // Size of the serialized message, if it was needed for routing.
+            uint64_t size;
+        };
+
+        // A socket in the pool.
+        struct Member
+        {
+            Socket* socket;
+            std::string address;
+            int port;
+            // Messages sent with this socket that are still queued or being sent, in the order they were sent.
+            std::deque<PendingMessage> pending;
+            // Total size of the pending messages.
+            uint64_t pending_bytes;
+            // When the socket is connected again after it failed, if set.
+            std::chrono::steady_clock::time_point reconnect_time;
+        };
+
+        Private()
+            : policy(RoutingPolicy::LeastBytes)
+            , reconnect_delay(1000)
+            , events(std::make_shared<Arcus::Private::SocketSetState>())
+            , next_member(0)
+            , monitor(nullptr)
+            , stopping(false)
+        {
+            events->only_state_changes = true;
+        }
+
+        // Remove the members whose socket was destroyed, which removed itself from the events. Called with the mutex locked.
+        void removeDestroyedMembers()
+        {
+            auto destroyed = std::remove_if(members.begin(), members.end(), [this](const Member& member)
+            {
+                return std::find(events->sockets.begin(), events->sockets.end(), member.socket) == events->sockets.end();
+            });
+            if(destroyed != members.end())
+            {
+                members.erase(destroyed, members.end());
+                buildRing();
+            }
+        }
+
+        // Wait until the pool no longer uses a socket without holding the mutex.
+        void waitUntilIdle(std::unique_lock<std::mutex>& lock, Socket* socket)
+        {
+            events->condition_variable.wait(lock, [this, socket]()
+            {
+                return std::find(events->busy.begin(), events->busy.end(), socket) == events->busy.end();
+            });
+        }
+
+        // Connect the failed members that are due again, unless they were closed with Socket::close() meanwhile.
+        //
+        // The lock is released meanwhile, since resetting a socket waits for its thread, which may be reporting
+        // its state to the pool. The sockets are marked as busy so they are not destroyed or removed meanwhile.
+        void reconnectSockets(std::unique_lock<std::mutex>& lock)
+        {
+            struct Endpoint
+            {
+                Socket* socket;
+                std::string address;
+                int port;
+            };
+
+            // The members may change meanwhile, so their endpoints are copied.
+            const auto now = std::chrono::steady_clock::now();
+            std::vector<Endpoint> due;
+            for(Member& member : members)
+            {
+                if(member.reconnect_time != std::chrono::steady_clock::time_point() && now >= member.reconnect_time)
+                {
+                    member.reconnect_time = std::chrono::steady_clock::time_point();
+                    due.push_back({member.socket, member.address, member.port});
+                    events->busy.push_back(member.socket);
+                }
+            }
+
+            if(due.empty())
+            {
+                return;
+            }
+
+            lock.unlock();
+            for(const Endpoint& endpoint : due)
+            {
+                endpoint.socket->reconnect(endpoint.address, endpoint.port);
+            }
+            lock.lock();
+
+            events->busy.clear();
+            events->condition_variable.notify_all();
+        }
+
+        // The earliest time a failed member is connected again, if any. Called with mutex locked.
+        std::chrono::steady_clock::time_point getNextReconnectTime() const
+        {
+            std::chrono::steady_clock::time_point next;
+            for(const Member& member : members)
+            {
+                if(member.reconnect_time != std::chrono::steady_clock::time_point() && (next == std::chrono::steady_clock::time_point() || member.reconnect_time < next))
+                {
+                    next = member.reconnect_time;
+                }
+            }
+            return next;
+        }
+
+        // Remove the messages that are no longer waiting to be sent from a member.
+        //
+        // Only the oldest messages are checked, so this takes constant time per message. Messages that
+        // overtook older ones of a lower priority are counted until those have been sent too.
+        static void removeSentMessages(Member& member)
+        {
+            while(!member.pending.empty())
+            {
+                SendStatus::SendStatus status = member.pending.front().handle.getStatus();
+                if(status == SendStatus::Queued || status == SendStatus::Sending)
+                {
+                    break;
+                }
+
+                member.pending_bytes -= member.pending.front().size;
+                member.pending.pop_front();
+            }
+        }
+
+        // Build the hash ring used for consistent hashing.
+        //
+        // Each member is placed on the ring at several points derived from its endpoint, so the
+        // keys are spread evenly and only the keys of a member move when it is added or removed.
+        void buildRing()
+        {
+            ring.clear();
+            for(std::size_t index = 0; index < members.size(); ++index)
+            {
+                for(int point = 0; point < ring_points; ++point)
+                {
+                    std::string name = members[index].address + ":" + std::to_string(members[index].port) + "#" + std::to_string(point);
+                    ring.emplace_back(Arcus::Private::crc32c(name.data(), name.size()), index);
+                }
+            }
+            std::sort(ring.begin(), ring.end());
+        }
+
+        std::atomic<RoutingPolicy::RoutingPolicy> policy;
+        std::atomic<int> reconnect_delay;
+
+        // The state changes of the sockets in the pool, reported like those of the sockets in a SocketSet.
+        // Its mutex guards the pool, and a socket that is destroyed removes itself from its sockets.
+        const std::shared_ptr<Arcus::Private::SocketSetState> events;
+        std::vector<Member> members;
+        // Points of the hash ring and the index of the member they belong to, sorted by point.
+        std::vector<std::pair<uint32_t, std::size_t>> ring;
+        // Member that is preferred when several are equally suitable, so they take turns.
+        std::size_t next_member;
+
+        // Thread that handles failed members when their state changes and reconnects them.
+        std::thread* monitor;
+        bool stopping;
+
+        // Amount of points on the hash ring for each member.
+        static const int ring_points = 64;
+    };
+}
+
+#endif //ARCUS_SOCKET_POOL_P_H
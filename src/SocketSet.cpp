@@ -0,0 +1,149 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SocketSet.h"
+#include "SocketSet_p.h"
+#include "Socket.h"
+
+#include <chrono>
+
+using namespace Arcus;
+
+SocketSet::SocketSet() : d(std::make_shared<Private::SocketSetState>())
+{
+}
+
+SocketSet::~SocketSet()
+{
+    for(Socket* socket : getSockets())
+    {
+        socket->removeSocketSet(d);
+    }
+}
+
+void SocketSet::addSocket(Socket* socket)
+{
+    if(!socket)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(d->mutex);
+        if(std::find(d->sockets.begin(), d->sockets.end(), socket) != d->sockets.end())
+        {
+            return;
+        }
+        d->sockets.push_back(socket);
+    }
+
+    // The socket notifies the set while holding its own lock, so do not hold the lock of the set here.
+    socket->addSocketSet(d);
+}
+
+void SocketSet::removeSocket(Socket* socket)
+{
+    {
+        std::lock_guard<std::mutex> lock(d->mutex);
+        auto position = std::find(d->sockets.begin(), d->sockets.end(), socket);
+        if(position == d->sockets.end())
+        {
+            return;
+        }
+        d->sockets.erase(position);
+    }
+
+    socket->removeSocketSet(d);
+
+    // The socket may have reported an event before it stopped notifying the set.
+    std::lock_guard<std::mutex> lock(d->mutex);
+    d->ready.erase(std::remove(d->ready.begin(), d->ready.end(), socket), d->ready.end());
+}
+
+std::vector<Socket*> SocketSet::getSockets() const
+{
+    std::lock_guard<std::mutex> lock(d->mutex);
+    return d->sockets;
+}
+
+std::vector<Socket*> SocketSet::wait(int timeout)
+{
+    std::unique_lock<std::mutex> lock(d->mutex);
+
+    auto has_events = [this]()
+    {
+        if(!d->ready.empty())
+        {
+            return true;
+        }
+
+        for(Socket* socket : d->sockets)
+        {
+            if(socket->hasPendingMessages())
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    if(timeout < 0)
+    {
+        d->condition_variable.wait(lock, has_events);
+    }
+    else if(!d->condition_variable.wait_for(lock, std::chrono::milliseconds(timeout), has_events))
+    {
+        return std::vector<Socket*>();
+    }
+
+    // Sockets that still have messages from before the previous call are reported again.
+    std::vector<Socket*> result;
+    result.swap(d->ready);
+    for(Socket* socket : d->sockets)
+    {
+        if(socket->hasPendingMessages() && std::find(result.begin(), result.end(), socket) == result.end())
+        {
+            result.push_back(socket);
+        }
+    }
+    return result;
+}
+
+MessagePtr SocketSet::takeNext(Socket** socket)
+{
+    std::lock_guard<std::mutex> lock(d->mutex);
+
+    const std::size_t count = d->sockets.size();
+    for(std::size_t offset = 0; offset < count; ++offset)
+    {
+        const std::size_t index = (d->next_socket + offset) % count;
+        MessagePtr message = d->sockets[index]->takePendingMessage();
+        if(message)
+        {
+            // Start at the next socket next time.
+            d->next_socket = index + 1;
+            if(socket)
+            {
+                *socket = d->sockets[index];
+            }
+            return message;
+        }
+    }
+
+    return MessagePtr();
+}
@@ -0,0 +1,101 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCUS_SOCKET_SET_H
+#define ARCUS_SOCKET_SET_H
+
+#include <memory>
+#include <vector>
+
+#include "Types.h"
+#include "ArcusExport.h"
+
+namespace Arcus
+{
+    class Socket;
+
+    namespace Private
+    {
+        class SocketSetState;
+    }
+
+    /**
+     * \brief A set of sockets that can be waited on together.
+     *
+     * This allows a single thread to handle the messages of many sockets, instead
+     * of needing a thread per socket to block in Socket::takeNextMessage().
+     *
+     * The set does not take ownership of the sockets. A socket that is destroyed
+     * is removed from any set it is in.
+     */
+    class ARCUS_EXPORT SocketSet
+    {
+    public:
+        SocketSet();
+        virtual ~SocketSet();
+
+        /**
+         * Add a socket to the set.
+         *
+         * \param socket The socket to add. Adding a socket that is already in the set does nothing.
+         */
+        void addSocket(Socket* socket);
+
+        /**
+         * Remove a socket from the set.
+         *
+         * \param socket The socket to remove.
+         */
+        void removeSocket(Socket* socket);
+
+        /**
+         * Get the sockets in the set.
+         */
+        std::vector<Socket*> getSockets() const;
+
+        /**
+         * Wait until a socket in the set has pending messages or changed state.
+         *
+         * \param timeout The maximum time in milliseconds to wait, or -1 to wait without limit.
+         *
+         * \return The sockets that have pending messages or changed state since the previous call,
+         * or an empty list if the timeout passed first.
+         */
+        std::vector<Socket*> wait(int timeout);
+
+        /**
+         * Remove and return the next pending message of any socket in the set without blocking.
+         *
+         * The sockets take turns, so a socket receiving many messages does not hold up the others.
+         *
+         * \param socket If not null, set to the socket the message was received on.
+         *
+         * \return The next message or an invalid pointer if no socket has pending messages.
+         */
+        MessagePtr takeNext(Socket** socket = nullptr);
+
+    private:
+        // Copy and assignment is not supported.
+        SocketSet(const SocketSet&);
+        SocketSet& operator=(const SocketSet& other);
+
+        const std::shared_ptr<Private::SocketSetState> d;
+    };
+}
+
+#endif // ARCUS_SOCKET_SET_H
@@ -0,0 +1,75 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCUS_SOCKET_SET_P_H
+#define ARCUS_SOCKET_SET_P_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+namespace Arcus
+{
+    class Socket;
+
+    namespace Private
+    {
+        /**
+         * Private class with the state of a SocketSet.
+         *
+         * Instances are shared between the SocketSet and the sockets in it, which
+         * report their events through notify() from their worker thread.
+         */
+        class SocketSetState
+        {
+        public:
+            SocketSetState()
+                : next_socket(0)
+                , only_state_changes(false)
+            {
+            }
+
+            // Report that a socket received a message or changed state.
+            inline void notify(Socket* socket)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(std::find(ready.begin(), ready.end(), socket) == ready.end())
+                {
+                    ready.push_back(socket);
+                }
+                condition_variable.notify_all();
+            }
+
+            std::mutex mutex;
+            std::condition_variable condition_variable;
+            // The sockets in the set.
+            std::vector<Socket*> sockets;
+            // Sockets that reported an event since the last call to SocketSet::wait().
+            std::vector<Socket*> ready;
+            // Index of the socket that SocketSet::takeNext() checks first.
+            std::size_t next_socket;
+            // Whether sockets only report state changes, not received messages.
+            bool only_state_changes;
+            // Sockets the owner of the state uses without holding the mutex. They are not destroyed until they are removed from it.
+            std::vector<Socket*> busy;
+        };
+    }
+}
+
+#endif //ARCUS_SOCKET_SET_P_H
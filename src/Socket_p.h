@@ -19,11 +19,16 @@
 #include <thread>
 #include <mutex>
 #include <string>
-#include <list>
 #include <unordered_map>
+#include <unordered_set>
 #include <deque>
+#include <vector>
+#include <cstring>
 #include <iostream>
 #include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
 
 #ifdef _WIN32
     #include <winsock2.h>
@@ -45,11 +50,21 @@
 #include "Socket.h"
 #include "Types.h"
 #include "SocketListener.h"
+#include "MessageHandler.h"
 #include "MessageTypeStore.h"
 #include "Error.h"
 
 #include "WireMessage_p.h"
+#include "OutgoingMessage_p.h"
+#include "SendQueue_p.h"
+#include "SocketSet_p.h"
+#include "SendScheduler_p.h"
+#include "MemoryBudget_p.h"
+#include "Executor_p.h"
+#include "Strands_p.h"
 #include "PlatformSocket_p.h"
+#include "PlatformThread_p.h"
+#include "Crc32c_p.h"
 
 #define VERSION_MAJOR 1
 #define VERSION_MINOR 0
@@ -57,8 +72,29 @@
 #define ARCUS_SIGNATURE 0x2BAD
 #define SIG(n) (((n) & 0xffff0000) >> 16)
 
+// The upper four bits of the minor version are used as flags describing the frame.
+#define FRAME_FLAG_CHUNKED 0x10 // The data is sent in chunks prefixed with their size.
+#define FRAME_FLAG_BATCH 0x20 // The data contains several messages, each prefixed with their size and type.
+#define FRAME_FLAG_CHECKSUM 0x40 // The frame starts with a sync marker and its header and data are each followed by their CRC32C.
+
+#define SYNC_MARKER 0xc5a3e10f // Marks the start of a frame with checksums, so the receiver can find it after corrupted data.
+
+#define CHUNK_CANCEL 0xffffffff // Sent instead of a chunk size when the sender aborts a chunked frame.
+
 #define SOCKET_CLOSE 0xf0f0f0f0
 
+// Compact frames start with a single tag byte followed by the varint encoded size and type index.
+#define V2_FRAME_TAG 0xb0 // The lower four bits contain the frame flags, shifted down.
+#define V2_KEEPALIVE 0xa0
+
+// Reserved type ID of the handshake that announces the frame formats and message types a socket supports.
+#define HANDSHAKE_TYPE_ID 0xa4c50002
+#define HANDSHAKE_VERSION 2
+
+#define CAPABILITY_COMPACT 0x1 // The socket accepts compact frames.
+#define CAPABILITY_CHECKSUM 0x2 // The socket accepts frames with checksums.
+#define CAPABILITY_DATAGRAM 0x4 // The socket receives datagrams on the port following the message types of the handshake.
+
 #ifdef ARCUS_DEBUG
     #define DEBUG(message) debug(message)
 #else
@@ -75,20 +111,156 @@ namespace Arcus
     class ARCUS_NO_EXPORT Socket::Private
     {
     public:
-        Private()
-            : state(SocketState::Initial)
+        typedef std::vector<SocketListener*> ListenerList;
+
+        /**
+         * Received messages waiting to be taken, see Socket::takeNextMessage().
+         */
+        struct ReceiveQueue
+        {
+            std::deque<MessagePtr> messages;
+            // Memory accounted for each message.
+            std::deque<uint32_t> sizes;
+            std::mutex mutex;
+            // Notified when a message is added and when the socket closes.
+            std::condition_variable condition_variable;
+        };
+
+        // A received element of a streamed field and the message it is part of.
+        struct StreamedElement
+        {
+            MessagePtr message;
+            // Type ID of the message the element is part of.
+            uint32_t type_id;
+            // Number of the field the element is part of.
+            int field_number;
+            // Sequence number of the message the element is part of, see WireMessage::stream_sequence.
+            uint64_t sequence;
+        };
+
+        /**
+         * The listeners of a socket, read for the duration of a notification.
+         *
+         * While a snapshot exists, the listener list it was taken from is not deleted.
+         */
+        class ListenerSnapshot
+        {
+        public:
+            ListenerSnapshot(const Private& d)
+                : d(d)
+            {
+                ++d.listener_readers;
+                getNotifyingSockets().push_back(&d);
+                list = d.listeners.load();
+            }
+
+            ~ListenerSnapshot()
+            {
+                getNotifyingSockets().pop_back();
+                --d.listener_readers;
+            }
+
+            ListenerList::const_iterator begin() const { return list->begin(); }
+            ListenerList::const_iterator end() const { return list->end(); }
+
+        private:
+            const Private& d;
+            const ListenerList* list;
+        };
+
+        Private(Socket* socket)
+            : socket(socket)
+            , state(SocketState::Initial)
             , next_state(SocketState::Initial)
             , received_close(false)
             , port(0)
+            , adopted_socket(-1)
             , thread(nullptr)
+            , closed(false)
+            , listeners(new ListenerList())
+            , listener_readers(0)
+            , listener_replacements(0)
+            , message_handler(nullptr)
+            , streamed_messages(0)
+            , progress_interval(0)
+            , chunked_frame_size(0)
+            , batch_delay(0)
+            , batch_size(0)
+            , batch_payload_size(0)
+            , batch_compact(false)
+            , connect_timeout(0)
+            , connect_retry_time(0)
+            , connect_retry_delay(10)
+            , connect_retry_maximum_delay(500)
+            , fast_open(false)
+            , direct_write(false)
+            , connection_writable(false)
+            , direct_write_failed(false)
+            , compact_frames(false)
+            , frame_checksums(false)
+            , datagram_channel(false)
+            , datagram_active(false)
+            , handshake_sent(false)
+            , peer_version(0)
+            , peer_capabilities(0)
+            , receiving_checksums(false)
+            , resynchronizing(false)
+            , receive_buffer(receive_buffer_size)
+            , receive_start(0)
+            , receive_end(0)
+            , messages_sent(0)
+            , messages_received(0)
+            , messages_cancelled(0)
+            , messages_expired(0)
+            , messages_dropped(0)
+            , bytes_sent(0)
+            , bytes_received(0)
+        {
+        }
+
+        ~Private()
         {
+            delete listeners.load();
+            for(auto& retired : retired_listeners)
+            {
+                delete retired.second;
+            }
         }
 
         void run();
-        void sendMessage(const MessagePtr& message);
+        void sendQueuedMessages();
+        void sendMessage(const std::shared_ptr<OutgoingMessage>& message);
+        void sendBatch();
+        void sendHandshake();
+        bool sendDatagram(const std::shared_ptr<OutgoingMessage>& outgoing);
+        bool writeDirectly(const std::shared_ptr<OutgoingMessage>& outgoing);
+        bool finishDirectWrite();
+        bool useCompactFrames() const;
+        bool useFrameChecksums() const;
+        int getPeerTypeIndex(uint32_t type_id) const;
+        void appendFrameHeader(std::string& frame, uint32_t flags, uint32_t size, uint32_t type, bool compact);
+        bool writeData(const char* data, uint32_t size);
+        bool waitForData(int timeout);
+        void spinForData();
         void receiveNextMessage();
-        void handleMessage(const std::shared_ptr<WireMessage>& wire_message);
+        bool receiveHeader();
+        int fillReceiveBuffer(std::size_t size);
+        void discardReceivedData();
+        void handleCorruptFrame(const std::string& message);
+        void handleBatch(const std::shared_ptr<WireMessage>& wire_message);
+        void handleHandshake(const char* data, uint32_t size);
+        void receiveDatagrams();
+        void handleMessage(uint32_t type_id, const char* data, uint32_t size);
+        void handleStreamedFields(const std::shared_ptr<WireMessage>& wire_message);
+        MessagePtr takeReceivedMessage(ReceiveQueue& queue);
+        MessagePtr popReceivedMessage(ReceiveQueue& queue);
+        void notifyReceiveQueues();
+        void dispatchMessage(uint32_t type_id, const MessagePtr& message, uint32_t size);
         void checkConnectionState();
+        void notifySocketSets(bool state_changed);
+        void replaceListeners(const ListenerList* list, std::unique_lock<std::mutex>& lock);
+        bool isNotifying() const;
+        static std::vector<const Private*>& getNotifyingSockets();
 
         #ifdef ARCUS_DEBUG
         void debug(const std::string& message);
@@ -96,6 +268,13 @@ namespace Arcus
         void error(ErrorCode::ErrorCode error_code, const std::string& message);
         void fatalError(ErrorCode::ErrorCode error_code, const std::string& msg);
 
+        static void appendUInt32(std::string& output, uint32_t value);
+        static void appendVarint(std::string& output, uint32_t value);
+        static int readVarint(const char* data, std::size_t size, uint32_t* value);
+
+        // The socket this is the implementation of.
+        Socket* const socket;
+
         SocketState::SocketState state;
         SocketState::SocketState next_state;
 
@@ -103,22 +282,63 @@ namespace Arcus
 
         std::string address;
         uint port;
+        // Connected platform socket passed to adoptFd(), or -1 to connect to address and port.
+        int adopted_socket;
 
         std::thread* thread;
-
-        std::list<SocketListener*> listeners;
+        // Whether close() was called since the socket was last started, so a SocketPool does not connect it again.
+        std::atomic<bool> closed;
+        // Serializes close() with a SocketPool connecting the socket again.
+        std::mutex lifecycle_mutex;
+
+        // Listeners to notify. The list is never changed, it is replaced as a whole by replaceListeners(),
+        // so notifications can read it without locking.
+        std::atomic<const ListenerList*> listeners;
+        // Amount of notifications in progress, which may be using a replaced listener list.
+        mutable std::atomic<int> listener_readers;
+        // Guards replacing the listener list and the replaced lists.
+        std::mutex listeners_mutex;
+        // Replaced listener lists that are not deleted yet, with the amount of replacements when they were replaced.
+        std::vector<std::pair<uint64_t, const ListenerList*>> retired_listeners;
+        uint64_t listener_replacements;
+
+        // Handler received messages are passed to instead of the receive queue, if any.
+        MessageHandler* message_handler;
+        // Fields holding the keys that order messages for the message handler, by message type ID.
+        std::unordered_map<uint32_t, const google::protobuf::FieldDescriptor*> message_key_fields;
+
+        // Sets this socket is in, which are notified of received messages and state changes.
+        std::vector<std::shared_ptr<SocketSetState>> socket_sets;
+        std::mutex socket_sets_mutex;
 
         MessageTypeStore message_types;
 
+        // Prototypes of the element types of streamed fields, by message type ID and field number.
+        std::unordered_map<uint32_t, std::unordered_map<int, const google::protobuf::Message*>> streamed_fields;
+
+        // Memory used by the message being received and the messages in the receive queue.
+        // Declared before them, so it outlives the messages that return memory to it.
+        MemoryBudget::Account receive_memory;
+
         std::shared_ptr<Arcus::Private::WireMessage> current_message;
 
-        std::deque<MessagePtr> sendQueue;
+        SendQueue sendQueue;
         std::mutex sendQueueMutex;
-        std::deque<MessagePtr> receiveQueue;
-        std::mutex receiveQueueMutex;
-
-        std::mutex receiveQueueMutexBlock;
-        std::condition_variable message_received_condition_variable;
+        // Default priorities of message types, by type ID. Guarded by sendQueueMutex.
+        std::unordered_map<uint32_t, MessagePriority::MessagePriority> message_type_priorities;
+        // Default time to live in milliseconds of message types, by type ID. Guarded by sendQueueMutex.
+        std::unordered_map<uint32_t, int> message_type_time_to_live;
+        // Type IDs of message types sent over the datagram channel. Guarded by sendQueueMutex.
+        std::unordered_set<uint32_t> datagram_types;
+        // Queue of the received messages of types without a queue of their own.
+        ReceiveQueue receive_queue;
+        // Queues set with Socket::setMessageTypeQueue(), by name, and the queue of each message type that has one, by type ID.
+        std::unordered_map<std::string, std::unique_ptr<ReceiveQueue>> named_receive_queues;
+        std::unordered_map<uint32_t, ReceiveQueue*> message_type_queues;
+        std::deque<StreamedElement> streamedQueue;
+        std::mutex streamedQueueMutex;
+        // Amount of messages whose elements were streamed.
+        uint64_t streamed_messages;
 
         Arcus::Private::PlatformSocket platform_socket;
 
@@ -126,6 +346,110 @@ namespace Arcus
 
         std::chrono::system_clock::time_point last_keep_alive_sent;
 
+        // Minimum time in milliseconds between two progress notifications for a message, 0 if progress reporting is disabled.
+        std::atomic<int> progress_interval;
+
+        // Minimum size of messages that are sent as chunked frames, 0 if chunked frames are disabled.
+        std::atomic<uint32_t> chunked_frame_size;
+
+        // Maximum time in milliseconds small messages are held back to be sent as a batch.
+        std::atomic<int> batch_delay;
+        // Maximum size of a batch frame, 0 if batching is disabled.
+        std::atomic<uint32_t> batch_size;
+
+        // Small messages collected to be sent together in one batch frame.
+        std::string batch_data;
+        std::vector<std::shared_ptr<OutgoingMessage>> batch_messages;
+        // When the collected batch has to be sent at the latest.
+        std::chrono::steady_clock::time_point batch_deadline;
+        // Total size of the messages in the collected batch, without their entry headers.
+        uint32_t batch_payload_size;
+        // Does the collected batch use compact frames?
+        bool batch_compact;
+
+        // Options of the network connection, only changed in the initial state.
+        SocketOptions options;
+        // Rate limit and fair queueing state of the data sent by this socket.
+        SendScheduler::Flow send_flow;
+
+        // Maximum time in milliseconds to wait for a connection attempt, 0 to wait as long as the platform does.
+        std::atomic<int> connect_timeout;
+        // Time in milliseconds during which failed connection attempts are retried, 0 to not retry.
+        std::atomic<int> connect_retry_time;
+        // Initial and maximum delay in milliseconds between connection attempts.
+        std::atomic<int> connect_retry_delay;
+        std::atomic<int> connect_retry_maximum_delay;
+        // When failed connection attempts are no longer retried.
+        std::chrono::steady_clock::time_point connect_deadline;
+        // Should TCP Fast Open be used?
+        std::atomic<bool> fast_open;
+        // Should threads sending messages write them to the connection themselves when possible?
+        std::atomic<bool> direct_write;
+        // Guards writing to the connection, closing it and the handshake state, since threads sending
+        // messages can write to it directly. Held by the socket thread while it sends.
+        std::mutex write_mutex;
+        // Whether the connection is established and not closed, so threads sending messages can write to it. Guarded by write_mutex.
+        bool connection_writable;
+        // Rest of a frame that a thread sending a message could only partly write, which the socket
+        // thread writes before anything else, and the message it belongs to. Guarded by write_mutex.
+        std::string direct_write_remainder;
+        std::shared_ptr<OutgoingMessage> direct_write_message;
+        // Whether a thread sending a message failed to write it, which the socket thread reports. Guarded by write_mutex.
+        bool direct_write_failed;
+
+        // Should messages be sent as compact frames once the peer supports them?
+        std::atomic<bool> compact_frames;
+        // Should frames be sent with sync marker and checksums once the peer supports them?
+        std::atomic<bool> frame_checksums;
+        // Should a datagram channel be opened once the peer supports it?
+        std::atomic<bool> datagram_channel;
+        // Is the datagram channel of the current connection connected to the peer?
+        std::atomic<bool> datagram_active;
+        // Guards opening, using and closing the datagram channel, which is also used by threads sending messages.
+        std::mutex datagram_mutex;
+
+        // Handshake state of the current connection, see sendHandshake().
+        bool handshake_sent;
+        uint32_t peer_version;
+        uint32_t peer_capabilities;
+        // Compact type index of message types in the table announced by the peer, by type ID.
+        std::unordered_map<uint32_t, uint32_t> peer_type_indices;
+        // The type IDs announced to the peer, by compact type index.
+        std::vector<uint32_t> announced_types;
+        // Has the peer sent frames with checksums, so corrupted data can be skipped up to the next sync marker?
+        bool receiving_checksums;
+        // Is received data being skipped up to the next sync marker?
+        bool resynchronizing;
+
+        // Data received from the socket that has not been processed yet.
+        std::vector<char> receive_buffer;
+        std::size_t receive_start;
+        std::size_t receive_end;
+
+        // Counters reported by Socket::getStatistics().
+        std::atomic<uint64_t> messages_sent;
+        std::atomic<uint64_t> messages_received;
+        std::atomic<uint64_t> messages_cancelled;
+        std::atomic<uint64_t> messages_expired;
+        std::atomic<uint64_t> messages_dropped;
+        std::atomic<uint64_t> bytes_sent;
+        std::atomic<uint64_t> bytes_received;
+
+        // Messages smaller than this are never reported through progress notifications.
+        static const uint32_t progress_minimum_size = 1048576;
+
+        // Message data is written to the socket in chunks of at most this size.
+        static const uint32_t send_chunk_size = 262144;
+
+        // Data is written in slices of at most this size when sending is rate limited.
+        static const uint32_t send_slice_size = 16384;
+
+        // Size of the buffer used to receive headers and small messages.
+        static const uint32_t receive_buffer_size = 65536;
+
+        // Largest datagram sent over the datagram channel, so datagrams are not fragmented on common networks.
+        static const uint32_t datagram_size_maximum = 1400;
+
         static const int keep_alive_rate = 500; //Number of milliseconds between sending keepalive packets
 
         // This value determines when protobuf should warn about very large messages.
@@ -134,13 +458,17 @@ namespace Arcus
         // This value determines when protobuf should error out because the message is too large.
         // Due to the way Protobuf is implemented, messages large than 512MiB will cause issues.
         static const int message_size_maximum = 500 * 1048576;
+
+        // Runs the message handler for received messages, ordered by key. Declared last, so it
+        // is destroyed first and waits for running handlers before anything they use is destroyed.
+        Strands handler_strands;
     };
 
     #ifdef ARCUS_DEBUG
     void Socket::Private::debug(const std::string& message)
     {
         Error error(ErrorCode::Debug, std::string("[DEBUG] ") + message);
-        for(auto listener : listeners)
+        for(auto listener : ListenerSnapshot(*this))
         {
             listener->error(error);
         }
@@ -155,7 +483,7 @@ namespace Arcus
 
         last_error = error;
 
-        for(auto listener : listeners)
+        for(auto listener : ListenerSnapshot(*this))
         {
             listener->error(error);
         }
@@ -170,10 +498,15 @@ namespace Arcus
 
         last_error = error;
 
-        platform_socket.close();
+        {
+            // Threads sending messages may be writing to the connection.
+            std::lock_guard<std::mutex> lock(write_mutex);
+            connection_writable = false;
+            platform_socket.close();
+        }
         next_state = SocketState::Error;
 
-        for(auto listener : listeners)
+        for(auto listener : ListenerSnapshot(*this))
         {
             listener->error(error);
         }
@@ -182,41 +515,130 @@ namespace Arcus
     // Thread run method.
     void Socket::Private::run()
     {
+        if(!options.thread_name.empty())
+        {
+            PlatformThread::setName(options.thread_name);
+        }
+        if(options.thread_cpu >= 0 && !PlatformThread::setAffinity(options.thread_cpu))
+        {
+            error(ErrorCode::UnknownError, "Could not run the socket thread on CPU " + std::to_string(options.thread_cpu));
+        }
+        if(options.thread_priority > 0 && !PlatformThread::setPriority(options.thread_priority))
+        {
+            error(ErrorCode::UnknownError, "Could not set the priority of the socket thread");
+        }
+
+        send_flow.configure(options.send_rate, options.send_burst, options.send_weight);
+        receive_memory.setLimit(options.receive_memory_limit);
+
+        // Connection attempts are retried until the deadline has passed.
+        connect_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(connect_retry_time);
+        std::chrono::milliseconds retry_delay(std::max(int(connect_retry_delay), 1));
+
+        // Nothing is known about the peer of a new connection.
+        write_mutex.lock();
+        handshake_sent = false;
+        peer_version = 0;
+        peer_capabilities = 0;
+        peer_type_indices.clear();
+        connection_writable = false;
+        direct_write_failed = false;
+        if(direct_write_message)
+        {
+            // The connection the message was partly written to is gone.
+            direct_write_message->status = SendStatus::Failed;
+            direct_write_message.reset();
+            direct_write_remainder.clear();
+        }
+        write_mutex.unlock();
+        receiving_checksums = false;
+        resynchronizing = false;
+        receive_start = 0;
+        receive_end = 0;
+
         while(state != SocketState::Closed && state != SocketState::Error)
         {
             switch(state)
             {
                 case SocketState::Connecting:
                 {
-                    if(!platform_socket.create())
+                    platform_socket.setOptions(options);
+
+                    bool connected = false;
+                    if(adopted_socket != -1)
+                    {
+                        // An adopted socket is already connected, so there is nothing to retry.
+                        connected = platform_socket.adopt(adopted_socket);
+                        adopted_socket = -1;
+                        if(!connected)
+                        {
+                            fatalError(ErrorCode::ConnectFailedError, "Could not use the given socket");
+                            break;
+                        }
+                    }
+                    else
+                    {
+                        connected = platform_socket.connect(address, port, connect_timeout, fast_open, [this]() { return next_state != SocketState::Connecting; });
+                    }
+
+                    if(next_state != SocketState::Connecting)
                     {
-                        fatalError(ErrorCode::CreationError, "Could not create a socket");
+                        // The socket was closed while connecting.
+                        platform_socket.close();
                     }
-                    else if(!platform_socket.connect(address, port))
+                    else if(!connected)
                     {
-                        fatalError(ErrorCode::ConnectFailedError, "Could not connect to the given address");
+                        auto now = std::chrono::steady_clock::now();
+                        if(now < connect_deadline)
+                        {
+                            // The peer may not be listening yet, so try again after a delay that doubles with every attempt.
+                            DEBUG("Could not connect, retrying in " + std::to_string(retry_delay.count()) + " ms");
+                            platform_socket.close();
+                            auto retry_time = std::min(now + retry_delay, connect_deadline);
+                            while(std::chrono::steady_clock::now() < retry_time && next_state == SocketState::Connecting)
+                            {
+                                std::this_thread::sleep_for(std::min(std::chrono::duration_cast<std::chrono::milliseconds>(retry_time - std::chrono::steady_clock::now()), std::chrono::milliseconds(10)));
+                            }
+                            retry_delay = std::min(retry_delay * 2, std::chrono::milliseconds(connect_retry_maximum_delay));
+                        }
+                        else
+                        {
+                            fatalError(ErrorCode::ConnectFailedError, "Could not connect to the given address");
+                        }
                     }
                     else
                     {
-                        if(!platform_socket.setReceiveTimeout(250))
+                        if(!platform_socket.setReceiveTimeout(options.receive_timeout))
                         {
                             fatalError(ErrorCode::ConnectFailedError, "Failed to set socket receive timeout");
                         }
                         else
                         {
-                            DEBUG("Socket connected");
-                            next_state = SocketState::Connected;
+                            if(!platform_socket.applyOptions())
+                            {
+                                error(ErrorCode::ConnectFailedError, "Could not apply all socket options");
+                            }
+
+                            // Socket::close() changes the next state with write_mutex locked as well, so it is not overwritten.
+                            std::lock_guard<std::mutex> lock(write_mutex);
+                            if(next_state == SocketState::Connecting)
+                            {
+                                DEBUG("Socket connected");
+                                next_state = SocketState::Connected;
+                                connection_writable = true;
+                            }
+                            else
+                            {
+                                platform_socket.close();
+                            }
                         }
                     }
                     break;
                 }
                 case SocketState::Opening:
                 {
-                    if(!platform_socket.create())
-                    {
-                        fatalError(ErrorCode::CreationError, "Could not create a socket");
-                    }
-                    else if(!platform_socket.bind(address, port))
+                    platform_socket.setOptions(options);
+                    if(!platform_socket.bind(address, port))
                     {
                         fatalError(ErrorCode::BindFailedError, "Could not bind to the given address and port");
                     }
@@ -228,44 +650,84 @@ namespace Arcus
                 }
                 case SocketState::Listening:
                 {
-                    platform_socket.listen(1);
+                    platform_socket.listen(1, fast_open);
                     if(!platform_socket.accept())
                     {
                         fatalError(ErrorCode::AcceptFailedError, "Could not accept the incoming connection");
                     }
                     else
                     {
-                        if(!platform_socket.setReceiveTimeout(250))
+                        if(!platform_socket.setReceiveTimeout(options.receive_timeout))
                         {
                             fatalError(ErrorCode::AcceptFailedError, "Could not set receive timeout of socket");
                         }
                         else
                         {
-                            DEBUG("Socket connected");
-                            next_state = SocketState::Connected;
+                            if(!platform_socket.applyOptions())
+                            {
+                                error(ErrorCode::AcceptFailedError, "Could not apply all socket options");
+                            }
+
+                            // Socket::close() changes the next state with write_mutex locked as well, so it is not overwritten.
+                            std::lock_guard<std::mutex> lock(write_mutex);
+                            if(next_state == SocketState::Listening)
+                            {
+                                DEBUG("Socket connected");
+                                next_state = SocketState::Connected;
+                                connection_writable = true;
+                            }
+                            else
+                            {
+                                platform_socket.close();
+                            }
                         }
                     }
                     break;
                 }
                 case SocketState::Connected:
                 {
-                    //Get all the messages from the queue and store them in a temporary array so we can
-                    //unlock the queue before performing the send.
-                    std::list<MessagePtr> messagesToSend;
-                    sendQueueMutex.lock();
-                    while(sendQueue.size() > 0)
+                    write_mutex.lock();
+                    finishDirectWrite();
+                    if((compact_frames || frame_checksums || datagram_channel) && !handshake_sent)
+                    {
+                        sendHandshake();
+                    }
+
+                    sendQueuedMessages();
+                    write_mutex.unlock();
+
+                    // While a batch is being collected, do not block on receiving for longer than the batch may wait.
+                    bool data_available = true;
+                    if(!batch_messages.empty())
+                    {
+                        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(batch_deadline - std::chrono::steady_clock::now());
+                        if(remaining.count() > 0)
+                        {
+                            data_available = receive_start < receive_end || waitForData(remaining.count());
+                        }
+                        else
+                        {
+                            std::lock_guard<std::mutex> lock(write_mutex);
+                            finishDirectWrite();
+                            sendBatch();
+                        }
+                    }
+
+                    // Datagrams are handled as soon as they arrive, instead of after the receive timeout.
+                    if(data_available && datagram_active && receive_start == receive_end)
                     {
-                        messagesToSend.push_back(sendQueue.front());
-                        sendQueue.pop_front();
+                        data_available = waitForData(options.receive_timeout);
                     }
-                    sendQueueMutex.unlock();
 
-                    for(auto message : messagesToSend)
+                    if(data_available && options.spin_time > 0 && receive_start == receive_end)
                     {
-                        sendMessage(message);
+                        spinForData();
                     }
 
-                    receiveNextMessage();
+                    if(data_available)
+                    {
+                        receiveNextMessage();
+                    }
 
                     if(next_state != SocketState::Error)
                     {
@@ -276,23 +738,16 @@ namespace Arcus
                 }
                 case SocketState::Closing:
                 {
+                    // Threads sending messages queue them from now on, see writeDirectly().
+                    std::lock_guard<std::mutex> write_lock(write_mutex);
+                    connection_writable = false;
+                    finishDirectWrite();
                     if(!received_close)
                     {
                         // We want to close the socket.
                         // First, flush the send queue so it is empty.
-                        std::list<MessagePtr> messagesToSend;
-                        sendQueueMutex.lock();
-                        while(sendQueue.size() > 0)
-                        {
-                            messagesToSend.push_back(sendQueue.front());
-                            sendQueue.pop_front();
-                        }
-                        sendQueueMutex.unlock();
-
-                        for(auto message : messagesToSend)
-                        {
-                            sendMessage(message);
-                        }
+                        sendQueuedMessages();
+                        sendBatch();
 
                         // Communicate to the other side that we want to close.
                         platform_socket.writeUInt32(SOCKET_CLOSE);
@@ -315,7 +770,10 @@ namespace Arcus
                         // The other side requested a close. Drop all pending messages
                         // since the other socket will not process them anyway.
                         sendQueueMutex.lock();
-                        sendQueue.clear();
+                        while(auto message = sendQueue.pop())
+                        {
+                            message->changeStatus(SendStatus::Queued, SendStatus::Failed);
+                        }
                         sendQueueMutex.unlock();
 
                         // Send confirmation to the other side that we received their close
@@ -342,243 +800,1635 @@ namespace Arcus
             {
                 state = next_state;
 
-                for(auto listener : listeners)
+                for(auto listener : ListenerSnapshot(*this))
                 {
                     listener->stateChanged(state);
                 }
+                notifySocketSets(true);
             }
         }
 
-        message_received_condition_variable.notify_all();
+        {
+            std::lock_guard<std::mutex> lock(datagram_mutex);
+            datagram_active = false;
+            platform_socket.closeDatagramChannel();
+        }
+
+        notifyReceiveQueues();
     }
 
-    // Send a message to the connected socket.
-    void Socket::Private::sendMessage(const MessagePtr& message)
+    // Send the messages that are currently queued, highest priority first.
+    void Socket::Private::sendQueuedMessages()
     {
-        uint32_t header = (ARCUS_SIGNATURE << 16) | (VERSION_MAJOR << 8) | (VERSION_MINOR);
-        if(platform_socket.writeUInt32(header) == -1)
+        // Messages are taken from the queue one at a time, so a message of higher priority
+        // queued while sending still overtakes the remaining messages of lower priority.
+        // Only the amount of messages queued right now is sent, so we get back to receiving
+        // even when new messages keep being queued.
+        sendQueueMutex.lock();
+        std::size_t count = sendQueue.size();
+        sendQueueMutex.unlock();
+
+        // Let the frames of several messages fill packets together, instead of sending a packet per write.
+        const bool corked = options.cork && count > 1;
+        if(corked)
         {
-            error(ErrorCode::SendFailedError, "Could not send message header");
-            return;
+            platform_socket.setCork(true);
         }
 
-        uint32_t message_size = message->ByteSize();
-        if(platform_socket.writeUInt32(message_size) == -1)
+        for(; count > 0; --count)
         {
-            error(ErrorCode::SendFailedError, "Could not send message size");
-            return;
+            sendQueueMutex.lock();
+            std::shared_ptr<OutgoingMessage> message = sendQueue.pop();
+            sendQueueMutex.unlock();
+
+            if(!message)
+            {
+                break;
+            }
+
+            sendMessage(message);
         }
 
-        uint32_t type_id = message_types.getMessageTypeId(message);
-        if(platform_socket.writeUInt32(type_id) == -1)
+        if(batch_delay == 0)
         {
-            error(ErrorCode::SendFailedError, "Could not send message type");
-            return;
+            sendBatch();
         }
 
-        std::string data = message->SerializeAsString();
-        if(platform_socket.writeBytes(data.size(), data.data()) == -1)
+        if(corked)
         {
-            error(ErrorCode::SendFailedError, "Could not send message data");
+            platform_socket.setCork(false);
         }
-        DEBUG(std::string("Sending message of type ") + std::to_string(type_id) + " and size " + std::to_string(message_size));
     }
 
-    // Handle receiving data until we have a proper message.
-    void Socket::Private::receiveNextMessage()
+    // Send a message to the connected socket.
+    void Socket::Private::sendMessage(const std::shared_ptr<OutgoingMessage>& outgoing)
     {
-        int result = 0;
-
-        if(!current_message)
+        // Drop messages that are no longer needed before spending any time on serializing them.
+        if(outgoing->hasExpired(std::chrono::steady_clock::now()) && outgoing->changeStatus(SendStatus::Queued, SendStatus::Expired))
         {
-            current_message = std::make_shared<WireMessage>();
+            DEBUG("Dropping expired message of type " + outgoing->message->GetTypeName());
+            ++messages_expired;
+            return;
         }
 
-        if(current_message->state == WireMessage::MessageState::Header)
+        // Messages taken over by another socket are sent by that socket, see Socket::takeOverMessage().
+        if(outgoing->status != SendStatus::Queued)
         {
-            uint32_t header = 0;
-            platform_socket.readUInt32(&header);
-
-            if(header == 0) // Keep-alive, just return
-            {
-                return;
-            }
-            else if(header == SOCKET_CLOSE)
+            if(outgoing->status == SendStatus::Cancelled)
             {
-                // We received a close request from the other socket, so close this socket as well.
-                next_state = SocketState::Closing;
-                received_close = true;
-                return;
+                ++messages_cancelled;
             }
+            return;
+        }
 
-            int signature = (header & 0xffff0000) >> 16;
-            int major_version = (header & 0x0000ff00) >> 8;
-            int minor_version = header & 0x000000ff;
+        const uint32_t chunked_size = chunked_frame_size;
+        const uint32_t maximum_batch_size = batch_size;
+        const MessagePtr& message = outgoing->message;
+        std::string data = message->SerializeAsString();
+        uint32_t message_size = data.size();
+        uint32_t type_id = message_types.getMessageTypeId(message);
+        // Types the peer did not announce are sent in regular frames.
+        int type_index = useCompactFrames() ? getPeerTypeIndex(type_id) : -1;
 
-            if(signature != ARCUS_SIGNATURE)
+        if(message_size + 8 <= maximum_batch_size)
+        {
+            if(!outgoing->changeStatus(SendStatus::Queued, SendStatus::Sending))
             {
-                // Someone might be speaking to us in a different protocol?
-                error(ErrorCode::ReceiveFailedError, "Header mismatch");
-                current_message.reset();
-                platform_socket.flush();
+                // Cancelled or taken over while it was being serialized.
+                if(outgoing->status == SendStatus::Cancelled)
+                {
+                    ++messages_cancelled;
+                }
                 return;
             }
 
-            if(major_version != VERSION_MAJOR)
+            if(batch_data.size() + message_size + 8 > maximum_batch_size || (!batch_messages.empty() && batch_compact != (type_index >= 0)))
             {
-                error(ErrorCode::ReceiveFailedError, "Protocol version mismatch");
-                current_message.reset();
-                platform_socket.flush();
-                return;
+                sendBatch();
             }
 
-            if(minor_version != VERSION_MINOR)
+            if(batch_messages.empty())
             {
-                error(ErrorCode::ReceiveFailedError, "Protocol version mismatch");
-                current_message.reset();
-                platform_socket.flush();
-                return;
+                batch_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(batch_delay);
+                batch_compact = type_index >= 0;
             }
 
-            DEBUG("Incoming message, header ok");
-            current_message->state = WireMessage::MessageState::Size;
+            if(batch_compact)
+            {
+                appendVarint(batch_data, message_size);
+                appendVarint(batch_data, type_index);
+            }
+            else
+            {
+                appendUInt32(batch_data, message_size);
+                appendUInt32(batch_data, type_id);
+            }
+            batch_data.append(data);
+            batch_messages.push_back(outgoing);
+            batch_payload_size += message_size;
+            return;
         }
 
-        if(current_message->state == WireMessage::MessageState::Size)
+        // Messages in a batch that is still being collected were queued before this message, so send them first.
+        sendBatch();
+
+        outgoing->chunked = chunked_size > 0 && message_size >= chunked_size;
+        if(!outgoing->changeStatus(SendStatus::Queued, SendStatus::Sending))
         {
-            uint32_t size = 0;
-            result = platform_socket.readUInt32(&size);
-            if(result == 0)
+            // Cancelled or taken over while it was being serialized.
+            if(outgoing->status == SendStatus::Cancelled)
             {
-                return;
+                ++messages_cancelled;
             }
-            else if(result == -1)
+            return;
+        }
+
+        uint32_t frame_flags = outgoing->chunked ? FRAME_FLAG_CHUNKED : 0;
+        const bool checksum = useFrameChecksums();
+        if(checksum)
+        {
+            frame_flags |= FRAME_FLAG_CHECKSUM;
+        }
+
+        std::string frame;
+        if(type_index >= 0)
+        {
+            appendFrameHeader(frame, frame_flags, message_size, type_index, true);
+        }
+        else
+        {
+            appendFrameHeader(frame, frame_flags, message_size, type_id, false);
+        }
+
+        // Small messages are sent together with their header in a single write.
+        const uint32_t data_checksum = checksum ? crc32c(data.data(), message_size) : 0;
+        const bool single_write = !outgoing->chunked && message_size <= send_chunk_size;
+        uint32_t sent_size = 0;
+        if(single_write)
+        {
+            frame.append(data);
+            sent_size = message_size;
+            if(checksum)
             {
-                error(ErrorCode::ReceiveFailedError, "Size invalid");
-                current_message.reset();
-                platform_socket.flush();
-                return;
+                appendUInt32(frame, data_checksum);
             }
+        }
 
-            DEBUG(std::string("Incoming message size: ") + std::to_string(size));
-            current_message->size = size;
-            current_message->state = WireMessage::MessageState::Type;
+        if(!writeData(frame.data(), frame.size()))
+        {
+            error(ErrorCode::SendFailedError, "Could not send message");
+            outgoing->status = SendStatus::Failed;
+            return;
         }
 
-        if (current_message->state == WireMessage::MessageState::Type)
+        // Write the data in chunks, both to handle partial writes and to be able to report progress.
+        const std::chrono::milliseconds interval(progress_interval);
+        const bool report_progress = interval.count() > 0 && message_size >= progress_minimum_size;
+        std::chrono::steady_clock::time_point last_progress;
+        while(sent_size < message_size)
         {
-            uint32_t type = 0;
-            result = platform_socket.readUInt32(&type);
-            if(result == 0)
+            uint32_t chunk_size = std::min(message_size - sent_size, static_cast<uint32_t>(send_chunk_size));
+
+            if(outgoing->chunked)
             {
-                return;
+                // Once the last chunk is being sent, the message can no longer be cancelled.
+                bool cancelled = sent_size + chunk_size == message_size
+                    ? !outgoing->changeStatus(SendStatus::Sending, SendStatus::Sent)
+                    : outgoing->status == SendStatus::Cancelled;
+                if(cancelled)
+                {
+                    DEBUG(std::string("Aborting cancelled message of type ") + std::to_string(type_id));
+                    platform_socket.writeUInt32(CHUNK_CANCEL);
+                    ++messages_cancelled;
+                    return;
+                }
+
+                if(platform_socket.writeUInt32(chunk_size) == -1)
+                {
+                    error(ErrorCode::SendFailedError, "Could not send chunk size");
+                    outgoing->status = SendStatus::Failed;
+                    return;
+                }
             }
-            else if(result == -1)
+
+            if(!writeData(data.data() + sent_size, chunk_size))
             {
-                error(ErrorCode::ReceiveFailedError, "Receiving type failed");
-                current_message->valid = false;
+                error(ErrorCode::SendFailedError, "Could not send message data");
+                outgoing->status = SendStatus::Failed;
+                return;
             }
+            sent_size += chunk_size;
 
-            uint32_t real_type = static_cast<uint32_t>(type);
-
-            try
+            if(report_progress)
             {
-                current_message->allocateData();
+                auto now = std::chrono::steady_clock::now();
+                if(sent_size == message_size || now - last_progress >= interval)
+                {
+                    last_progress = now;
+                    for(auto listener : ListenerSnapshot(*this))
+                    {
+                        listener->sendProgress(type_id, sent_size, message_size);
+                    }
+                }
             }
-            catch (std::bad_alloc&)
+        }
+
+        if(checksum && !single_write)
+        {
+            if(platform_socket.writeUInt32(data_checksum) == -1)
             {
-                // Either way we're in trouble.
-                current_message.reset();
-                fatalError(ErrorCode::ReceiveFailedError, "Out of memory");
+                error(ErrorCode::SendFailedError, "Could not send message checksum");
+                outgoing->status = SendStatus::Failed;
                 return;
             }
+        }
 
-            DEBUG(std::string("Incoming message type: ") + std::to_string(real_type));
-            current_message->type = real_type;
-            current_message->state = WireMessage::MessageState::Data;
+        outgoing->status = SendStatus::Sent;
+        ++messages_sent;
+        bytes_sent += message_size;
+        DEBUG(std::string("Sending message of type ") + std::to_string(type_id) + " and size " + std::to_string(message_size));
+    }
+
+    // Write a message to the connection on the thread sending it, instead of queueing it for the socket thread.
+    //
+    // This is only done for small messages when nothing is waiting to be sent and the socket thread is not
+    // writing, so messages stay in order. Returns false if the message should be queued instead.
+    bool Socket::Private::writeDirectly(const std::shared_ptr<OutgoingMessage>& outgoing)
+    {
+        std::unique_lock<std::mutex> write_lock(write_mutex, std::try_to_lock);
+        if(!write_lock.owns_lock() || !connection_writable || !batch_messages.empty() || batch_size > 0 || direct_write_message)
+        {
+            return false;
         }
 
-        if (current_message->state == WireMessage::MessageState::Data)
+        if((compact_frames || frame_checksums || datagram_channel) && !handshake_sent)
         {
-            result = platform_socket.readBytes(current_message->getRemainingSize(), &current_message->data[current_message->received_size]);
+            return false;
+        }
 
-            if(result < 0)
+        if(SendScheduler::getInstance().isLimited(send_flow))
+        {
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(sendQueueMutex);
+            if(sendQueue.size() > 0)
             {
-                error(ErrorCode::ReceiveFailedError, "Could not receive data for message");
-                current_message.reset();
-                return;
+                return false;
             }
-            else
-            {
-                current_message->received_size = current_message->received_size + result;
-
-                DEBUG("Received " + std::to_string(result) + " bytes data");
+        }
 
-                if(current_message->isComplete())
-                {
-                    if(!current_message->valid)
-                    {
-                        current_message.reset();
-                        return;
-                    }
+        const MessagePtr& message = outgoing->message;
+        const std::size_t message_size = message->ByteSizeLong();
+        const uint32_t chunked_size = chunked_frame_size;
+        if(message_size > send_chunk_size || (chunked_size > 0 && message_size >= chunked_size))
+        {
+            return false;
+        }
 
-                    current_message->state = WireMessage::MessageState::Dispatch;
-                }
-            }
+        if(!outgoing->changeStatus(SendStatus::Queued, SendStatus::Sending))
+        {
+            return false;
         }
 
-        if (current_message->state == WireMessage::MessageState::Dispatch)
+        std::string data = message->SerializeAsString();
+        uint32_t type_id = message_types.getMessageTypeId(message);
+        int type_index = useCompactFrames() ? getPeerTypeIndex(type_id) : -1;
+        const bool checksum = useFrameChecksums();
+
+        std::string frame;
+        if(type_index >= 0)
         {
-            handleMessage(current_message);
-            current_message.reset();
+            appendFrameHeader(frame, checksum ? FRAME_FLAG_CHECKSUM : 0, data.size(), type_index, true);
+        }
+        else
+        {
+            appendFrameHeader(frame, checksum ? FRAME_FLAG_CHECKSUM : 0, data.size(), type_id, false);
+        }
+        frame.append(data);
+        if(checksum)
+        {
+            appendUInt32(frame, crc32c(data.data(), data.size()));
         }
-    }
 
-    // Parse and process a message received on the socket.
-    void Socket::Private::handleMessage(const std::shared_ptr<WireMessage>& wire_message)
-    {
-        if(!message_types.hasType(wire_message->type))
+        // When the send buffer is full, let the socket thread wait for room instead of this thread.
+        socket_size written = platform_socket.writeBytesNonBlocking(frame.size(), frame.data());
+        if(written == 0)
         {
-            DEBUG(std::string("Received message type: ") + std::to_string(wire_message->type));
-            error(ErrorCode::UnknownMessageTypeError, "Unknown message type");
-            return;
+            outgoing->status = SendStatus::Queued;
+            return false;
         }
 
-        MessagePtr message = message_types.createMessage(wire_message->type);
+        // Errors are reported by the socket thread, so listeners are only called from there.
+        if(written < 0)
+        {
+            outgoing->status = SendStatus::Failed;
+            direct_write_failed = true;
+            return true;
+        }
 
-        google::protobuf::io::ArrayInputStream array(wire_message->data, wire_message->size);
-        google::protobuf::io::CodedInputStream stream(&array);
-        stream.SetTotalBytesLimit(message_size_maximum, message_size_warning);
-        if(!message->ParseFromCodedStream(&stream))
+        // Once part of the frame has been written, the rest has to follow. The socket thread waits for room to write it.
+        if(static_cast<std::size_t>(written) < frame.size())
         {
-            error(ErrorCode::ParseFailedError, "Failed to parse message:" + std::string(wire_message->data));
-            return;
+            direct_write_remainder.assign(frame, written, std::string::npos);
+            direct_write_message = outgoing;
+            return true;
         }
 
-        DEBUG(std::string("Received a message of type ") + std::to_string(wire_message->type) + " and size " + std::to_string(wire_message->size));
+        outgoing->status = SendStatus::Sent;
+        ++messages_sent;
+        bytes_sent += data.size();
+        return true;
+    }
+
+    // Report a failed direct write and write the rest of a frame that was partly written by writeDirectly(). Called with write_mutex locked.
+    //
+    // Returns false if it could not be written, in which case the connection can no longer be used.
+    bool Socket::Private::finishDirectWrite()
+    {
+        if(direct_write_failed)
+        {
+            direct_write_failed = false;
+            error(ErrorCode::SendFailedError, "Could not send message");
+        }
 
-        receiveQueueMutex.lock();
-        receiveQueue.push_back(message);
-        receiveQueueMutex.unlock();
+        if(!direct_write_message)
+        {
+            return true;
+        }
 
-        for(auto listener : listeners)
+        std::shared_ptr<OutgoingMessage> outgoing = std::move(direct_write_message);
+        direct_write_message.reset();
+        bool sent = writeData(direct_write_remainder.data(), direct_write_remainder.size());
+        direct_write_remainder.clear();
+        if(!sent)
         {
-            listener->messageReceived();
+            error(ErrorCode::SendFailedError, "Could not send message");
+            outgoing->status = SendStatus::Failed;
+            return false;
         }
 
-        message_received_condition_variable.notify_all();
+        outgoing->status = SendStatus::Sent;
+        ++messages_sent;
+        bytes_sent += outgoing->message->ByteSizeLong();
+        return true;
     }
 
-    // Send a keepalive packet to check whether we are still connected.
-    void Socket::Private::checkConnectionState()
+    // Send the collected batch of small messages as one frame.
+    void Socket::Private::sendBatch()
     {
-        auto now = std::chrono::system_clock::now();
-        auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_keep_alive_sent);
+        if(batch_messages.empty())
+        {
+            return;
+        }
 
-        if(diff.count() > keep_alive_rate)
+        uint32_t frame_size = batch_data.size();
+        uint32_t message_count = batch_messages.size();
+
+        // For batch frames, the type field contains the amount of messages in the batch.
+        const bool checksum = useFrameChecksums();
+        std::string frame;
+        appendFrameHeader(frame, FRAME_FLAG_BATCH | (checksum ? FRAME_FLAG_CHECKSUM : 0), frame_size, message_count, batch_compact);
+        frame.append(batch_data);
+        if(checksum)
         {
+            appendUInt32(frame, crc32c(batch_data.data(), frame_size));
+        }
+
+        bool sent = writeData(frame.data(), frame.size());
+        if(!sent)
+        {
+            error(ErrorCode::SendFailedError, "Could not send batch of messages");
+        }
+
+        for(auto& message : batch_messages)
+        {
+            message->status = sent ? SendStatus::Sent : SendStatus::Failed;
+        }
+
+        if(sent)
+        {
+            messages_sent += message_count;
+            bytes_sent += batch_payload_size;
+        }
+
+        DEBUG(std::string("Sending batch of ") + std::to_string(message_count) + " messages and size " + std::to_string(frame_size));
+
+        batch_data.clear();
+        batch_messages.clear();
+        batch_payload_size = 0;
+    }
+
+    // Announce the frame formats and message types this socket supports to the peer.
+    //
+    // The handshake is sent as a regular frame so peers that do not support it only report an unknown
+    // message type. Its data contains the handshake version, the capability flags, the amount of message
+    // types and the type IDs themselves, all as 32-bit integers. The position of a type ID in this list
+    // is the compact type index the peer uses for it.
+    void Socket::Private::sendHandshake()
+    {
+        announced_types = message_types.getMessageTypeIds();
+
+        uint32_t capabilities = CAPABILITY_COMPACT | CAPABILITY_CHECKSUM;
+        int datagram_port = 0;
+        if(datagram_channel)
+        {
+            std::lock_guard<std::mutex> lock(datagram_mutex);
+            datagram_port = platform_socket.openDatagramChannel();
+            if(datagram_port != 0)
+            {
+                capabilities |= CAPABILITY_DATAGRAM;
+            }
+            else
+            {
+                error(ErrorCode::CreationError, "Could not open datagram channel");
+            }
+        }
+
+        std::string data;
+        appendUInt32(data, HANDSHAKE_VERSION);
+        appendUInt32(data, capabilities);
+        appendUInt32(data, announced_types.size());
+        for(uint32_t type_id : announced_types)
+        {
+            appendUInt32(data, type_id);
+        }
+        if(datagram_port != 0)
+        {
+            appendUInt32(data, datagram_port);
+        }
+
+        std::string frame;
+        appendFrameHeader(frame, 0, data.size(), HANDSHAKE_TYPE_ID, false);
+        frame.append(data);
+
+        if(!writeData(frame.data(), frame.size()))
+        {
+            error(ErrorCode::SendFailedError, "Could not send handshake");
+        }
+        handshake_sent = true;
+    }
+
+    // Send a message of a datagram type over the datagram channel.
+    //
+    // Returns false if the message should be sent over the connection instead, because it is not of a
+    // datagram type or does not fit in a datagram. Can be called from any thread.
+    bool Socket::Private::sendDatagram(const std::shared_ptr<OutgoingMessage>& outgoing)
+    {
+        const uint32_t type_id = message_types.getMessageTypeId(outgoing->message);
+        {
+            std::lock_guard<std::mutex> lock(sendQueueMutex);
+            if(datagram_types.find(type_id) == datagram_types.end())
+            {
+                return false;
+            }
+        }
+
+        std::string datagram;
+        appendUInt32(datagram, type_id);
+        datagram.append(outgoing->message->SerializeAsString());
+        if(datagram.size() > datagram_size_maximum || !outgoing->changeStatus(SendStatus::Queued, SendStatus::Sending))
+        {
+            return false;
+        }
+
+        socket_size sent = -1;
+        {
+            std::lock_guard<std::mutex> lock(datagram_mutex);
+            if(datagram_active)
+            {
+                sent = platform_socket.writeDatagram(datagram.size(), datagram.data());
+            }
+        }
+
+        if(sent != static_cast<socket_size>(datagram.size()))
+        {
+            outgoing->changeStatus(SendStatus::Sending, SendStatus::Dropped);
+            ++messages_dropped;
+            return true;
+        }
+
+        outgoing->changeStatus(SendStatus::Sending, SendStatus::Sent);
+        ++messages_sent;
+        bytes_sent += datagram.size() - 4;
+        return true;
+    }
+
+    // Should frames be sent in the compact format?
+    bool Socket::Private::useCompactFrames() const
+    {
+        return compact_frames && peer_version >= HANDSHAKE_VERSION && (peer_capabilities & CAPABILITY_COMPACT) != 0;
+    }
+
+    // Should frames be sent with sync marker and checksums?
+    bool Socket::Private::useFrameChecksums() const
+    {
+        return frame_checksums && peer_version >= HANDSHAKE_VERSION && (peer_capabilities & CAPABILITY_CHECKSUM) != 0;
+    }
+
+    // Get the compact index of a message type for the peer, or -1 if the peer did not announce the type.
+    int Socket::Private::getPeerTypeIndex(uint32_t type_id) const
+    {
+        auto index = peer_type_indices.find(type_id);
+        return index != peer_type_indices.end() ? static_cast<int>(index->second) : -1;
+    }
+
+    // Append the header of a frame to a buffer.
+    //
+    // For compact frames, type must be the compact type index instead of the type ID. Frames with
+    // checksums start with the sync marker and have the checksum of the header appended to it.
+    void Socket::Private::appendFrameHeader(std::string& frame, uint32_t flags, uint32_t size, uint32_t type, bool compact)
+    {
+        if(flags & FRAME_FLAG_CHECKSUM)
+        {
+            appendUInt32(frame, SYNC_MARKER);
+        }
+
+        const std::size_t header_start = frame.size();
+        if(compact)
+        {
+            frame.push_back(static_cast<char>(V2_FRAME_TAG | (flags >> 4)));
+            appendVarint(frame, size);
+            appendVarint(frame, type);
+        }
+        else
+        {
+            appendUInt32(frame, (ARCUS_SIGNATURE << 16) | (VERSION_MAJOR << 8) | VERSION_MINOR | flags);
+            appendUInt32(frame, size);
+            appendUInt32(frame, type);
+        }
+
+        if(flags & FRAME_FLAG_CHECKSUM)
+        {
+            appendUInt32(frame, crc32c(frame.data() + header_start, frame.size() - header_start));
+        }
+    }
+
+    // Append an unsigned 32-bit integer in network byte order.
+    void Socket::Private::appendUInt32(std::string& output, uint32_t value)
+    {
+        uint32_t network_value = htonl(value);
+        output.append(reinterpret_cast<const char*>(&network_value), sizeof(network_value));
+    }
+
+    // Append an unsigned 32-bit integer as varint, seven bits per byte with the lowest bits first.
+    void Socket::Private::appendVarint(std::string& output, uint32_t value)
+    {
+        while(value >= 0x80)
+        {
+            output.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        output.push_back(static_cast<char>(value));
+    }
+
+    // Read a varint from a buffer.
+    //
+    // Returns the amount of bytes used by the varint, 0 if the buffer does not contain
+    // the complete varint, or -1 if it does not fit in 32 bits.
+    int Socket::Private::readVarint(const char* data, std::size_t size, uint32_t* value)
+    {
+        uint32_t result = 0;
+        for(std::size_t i = 0; i < 5; ++i)
+        {
+            if(i >= size)
+            {
+                return 0;
+            }
+
+            uint8_t byte = static_cast<uint8_t>(data[i]);
+            if(i == 4 && byte > 0x0f)
+            {
+                return -1;
+            }
+
+            result |= static_cast<uint32_t>(byte & 0x7f) << (7 * i);
+            if((byte & 0x80) == 0)
+            {
+                *value = result;
+                return static_cast<int>(i + 1);
+            }
+        }
+        return -1;
+    }
+
+    // Write data to the socket, using as many writes as needed.
+    bool Socket::Private::writeData(const char* data, uint32_t size)
+    {
+        // With a rate limit, data is written in slices, so sockets sharing the total rate take turns.
+        SendScheduler& scheduler = SendScheduler::getInstance();
+        const bool limited = scheduler.isLimited(send_flow);
+
+        uint32_t written = 0;
+        while(written < size)
+        {
+            uint32_t slice_size = size - written;
+            if(limited)
+            {
+                slice_size = std::min(slice_size, uint32_t(send_slice_size));
+                scheduler.acquire(send_flow, slice_size);
+            }
+
+            socket_size result = platform_socket.writeBytes(slice_size, data + written);
+            if(result <= 0)
+            {
+                return false;
+            }
+            written += result;
+        }
+        return true;
+    }
+
+    // Keep checking for data for a while before waiting for it in a blocking receive.
+    //
+    // Waking up from a blocking receive takes a lot longer than noticing the data while checking for
+    // it, at the cost of keeping a processor busy. Stops early when there are messages to send.
+    void Socket::Private::spinForData()
+    {
+        const auto spin_end = std::chrono::steady_clock::now() + std::chrono::microseconds(options.spin_time);
+        while(!platform_socket.waitForData(0) && std::chrono::steady_clock::now() < spin_end)
+        {
+            {
+                std::lock_guard<std::mutex> lock(sendQueueMutex);
+                if(sendQueue.size() > 0)
+                {
+                    return;
+                }
+            }
+
+            // Let other threads that are ready to run go first, such as a thread producing the data we wait for.
+            std::this_thread::yield();
+        }
+    }
+
+    // Wait until there is data available on the connection, handling any datagrams that arrive in the meantime.
+    bool Socket::Private::waitForData(int timeout)
+    {
+        if(!datagram_active)
+        {
+            return platform_socket.waitForData(timeout);
+        }
+
+        bool datagram_available = false;
+        bool data_available = platform_socket.waitForData(timeout, datagram_available);
+        if(datagram_available)
+        {
+            receiveDatagrams();
+        }
+        return data_available;
+    }
+
+    // Handle receiving data until we have a proper message.
+    void Socket::Private::receiveNextMessage()
+    {
+        if(!current_message)
+        {
+            current_message = std::make_shared<WireMessage>();
+        }
+
+        if(current_message->state == WireMessage::MessageState::Header)
+        {
+            if(!receiveHeader())
+            {
+                return;
+            }
+        }
+
+        if(current_message->state == WireMessage::MessageState::Data)
+        {
+            uint32_t read_size = current_message->getRemainingSize();
+            if(current_message->chunked)
+            {
+                if(current_message->chunk_remaining == 0)
+                {
+                    int result = fillReceiveBuffer(4);
+                    if(result == 0)
+                    {
+                        return;
+                    }
+                    else if(result == -1)
+                    {
+                        error(ErrorCode::ReceiveFailedError, "Could not receive chunk size");
+                        current_message.reset();
+                        return;
+                    }
+
+                    uint32_t chunk_size = 0;
+                    std::memcpy(&chunk_size, &receive_buffer[receive_start], 4);
+                    chunk_size = ntohl(chunk_size);
+                    receive_start += 4;
+
+                    if(chunk_size == CHUNK_CANCEL)
+                    {
+                        DEBUG(std::string("Message of type ") + std::to_string(current_message->type) + " was cancelled by the sender");
+                        current_message.reset();
+                        return;
+                    }
+
+                    if(chunk_size == 0 || chunk_size > read_size)
+                    {
+                        handleCorruptFrame("Chunk size invalid");
+                        return;
+                    }
+
+                    current_message->chunk_remaining = chunk_size;
+                }
+
+                read_size = current_message->chunk_remaining;
+            }
+
+            // Small amounts of data are received through the receive buffer, so the headers of the
+            // frames that follow are received with the same read. Large amounts are read directly.
+            if(receive_start == receive_end && read_size > 0 && read_size < receive_buffer_size)
+            {
+                if(fillReceiveBuffer(1) == -1)
+                {
+                    error(ErrorCode::ReceiveFailedError, "Could not receive data for message");
+                    current_message.reset();
+                    return;
+                }
+            }
+
+            const uint32_t received_start = current_message->received_size;
+            uint32_t received = 0;
+            if(receive_start < receive_end)
+            {
+                received = std::min(static_cast<uint32_t>(receive_end - receive_start), read_size);
+                std::memcpy(&current_message->data[current_message->received_size], &receive_buffer[receive_start], received);
+                receive_start += received;
+            }
+            else if(read_size > 0)
+            {
+                socket_size result = platform_socket.readBytes(read_size, &current_message->data[current_message->received_size]);
+                if(result < 0)
+                {
+                    error(ErrorCode::ReceiveFailedError, "Could not receive data for message");
+                    current_message.reset();
+                    return;
+                }
+                received = result;
+            }
+
+            current_message->received_size = current_message->received_size + received;
+            if(current_message->checksum)
+            {
+                current_message->data_checksum = crc32c(current_message->data + received_start, received, current_message->data_checksum);
+            }
+            if(current_message->chunked)
+            {
+                current_message->chunk_remaining -= received;
+            }
+
+            DEBUG("Received " + std::to_string(received) + " bytes data");
+
+            // Elements of frames with a checksum are only passed on once the checksum has been verified.
+            if(current_message->valid && !current_message->batch && !current_message->checksum && !streamed_fields.empty())
+            {
+                handleStreamedFields(current_message);
+            }
+
+            const std::chrono::milliseconds interval(progress_interval);
+            if(interval.count() > 0 && !current_message->batch && current_message->size >= progress_minimum_size)
+            {
+                auto now = std::chrono::steady_clock::now();
+                if(current_message->isComplete() || now - current_message->last_progress >= interval)
+                {
+                    current_message->last_progress = now;
+                    for(auto listener : ListenerSnapshot(*this))
+                    {
+                        listener->receiveProgress(current_message->type, current_message->received_size, current_message->size);
+                    }
+                }
+            }
+
+            if(current_message->isComplete())
+            {
+                current_message->state = current_message->checksum ? WireMessage::MessageState::Checksum : WireMessage::MessageState::Dispatch;
+            }
+        }
+
+        if(current_message->state == WireMessage::MessageState::Checksum)
+        {
+            int result = fillReceiveBuffer(4);
+            if(result != 1)
+            {
+                if(result == -1)
+                {
+                    error(ErrorCode::ReceiveFailedError, "Could not receive message checksum");
+                    current_message.reset();
+                }
+                return;
+            }
+
+            uint32_t data_checksum = 0;
+            std::memcpy(&data_checksum, &receive_buffer[receive_start], 4);
+            receive_start += 4;
+
+            // The header was intact, so the next frame starts right after this one and only this message is lost.
+            if(ntohl(data_checksum) != current_message->data_checksum)
+            {
+                error(ErrorCode::ReceiveFailedError, "Message checksum mismatch");
+                current_message.reset();
+                return;
+            }
+
+            if(current_message->valid && !current_message->batch && !streamed_fields.empty())
+            {
+                handleStreamedFields(current_message);
+            }
+
+            current_message->state = WireMessage::MessageState::Dispatch;
+        }
+
+        if(current_message->state == WireMessage::MessageState::Dispatch && !current_message->valid)
+        {
+            current_message.reset();
+            return;
+        }
+
+        if (current_message->state == WireMessage::MessageState::Dispatch)
+        {
+            if(current_message->batch)
+            {
+                handleBatch(current_message);
+            }
+            else if(current_message->type == HANDSHAKE_TYPE_ID && !current_message->compact)
+            {
+                handleHandshake(current_message->data, current_message->size);
+            }
+            else
+            {
+                handleMessage(current_message->type, current_message->data, current_message->size);
+            }
+            current_message.reset();
+        }
+    }
+
+    // Receive the header of the next frame, in either the regular or the compact format.
+    //
+    // Returns true once the complete header has been received and the message is ready to receive its data.
+    bool Socket::Private::receiveHeader()
+    {
+        int result = fillReceiveBuffer(1);
+        if(result != 1)
+        {
+            return false;
+        }
+
+        if(resynchronizing)
+        {
+            // Skip data up to the next sync marker. The last three bytes are kept in case they are the start of the marker.
+            const char marker[4] = { char(SYNC_MARKER >> 24), char(SYNC_MARKER >> 16), char(SYNC_MARKER >> 8), char(SYNC_MARKER) };
+            while(true)
+            {
+                const char* start = receive_buffer.data() + receive_start;
+                const char* end = receive_buffer.data() + receive_end;
+                const char* found = std::search(start, end, marker, marker + 4);
+                if(found != end)
+                {
+                    receive_start += found - start;
+                    resynchronizing = false;
+                    DEBUG("Found sync marker, receiving the next frame");
+                    break;
+                }
+
+                receive_start = std::max(receive_start, receive_end - std::min<std::size_t>(receive_end, 3));
+                result = fillReceiveBuffer(receive_end - receive_start + 1);
+                if(result != 1)
+                {
+                    return false;
+                }
+            }
+        }
+
+        // Frames with checksums start with the sync marker, followed by the header.
+        std::size_t offset = 0;
+        bool checksum = false;
+        if(static_cast<uint8_t>(receive_buffer[receive_start]) == (SYNC_MARKER >> 24))
+        {
+            result = fillReceiveBuffer(5);
+            if(result != 1)
+            {
+                return false;
+            }
+
+            uint32_t marker = 0;
+            std::memcpy(&marker, &receive_buffer[receive_start], 4);
+            if(ntohl(marker) != SYNC_MARKER)
+            {
+                handleCorruptFrame("Header mismatch");
+                return false;
+            }
+
+            offset = 4;
+            checksum = true;
+        }
+
+        const uint8_t tag = static_cast<uint8_t>(receive_buffer[receive_start + offset]);
+        if(tag == V2_KEEPALIVE && !checksum)
+        {
+            ++receive_start;
+            return false;
+        }
+
+        uint32_t frame_flags = 0;
+        uint32_t size = 0;
+        uint32_t type = 0;
+        std::size_t header_size = 0;
+        bool compact = false;
+
+        if((tag & 0xf0) == V2_FRAME_TAG)
+        {
+            // Compact header, the size and type index are varints so wait until both have been received.
+            int size_length = 0;
+            int type_length = 0;
+            while(true)
+            {
+                const char* header = &receive_buffer[receive_start + offset];
+                const std::size_t available = receive_end - receive_start - offset;
+                size_length = readVarint(header + 1, available - 1, &size);
+                type_length = size_length > 0 ? readVarint(header + 1 + size_length, available - 1 - size_length, &type) : size_length;
+                if(size_length != 0 && type_length != 0)
+                {
+                    break;
+                }
+
+                result = fillReceiveBuffer(offset + available + 1);
+                if(result != 1)
+                {
+                    if(result == -1)
+                    {
+                        error(ErrorCode::ReceiveFailedError, "Could not receive message header");
+                        current_message.reset();
+                    }
+                    return false;
+                }
+            }
+
+            if(size_length < 0 || type_length < 0)
+            {
+                handleCorruptFrame("Header mismatch");
+                return false;
+            }
+
+            header_size = 1 + size_length + type_length;
+            frame_flags = (tag & 0x0f) << 4;
+            compact = true;
+        }
+        else
+        {
+            result = fillReceiveBuffer(offset + 4);
+            if(result != 1)
+            {
+                return false;
+            }
+
+            uint32_t header = 0;
+            std::memcpy(&header, &receive_buffer[receive_start + offset], 4);
+            header = ntohl(header);
+
+            if(header == 0 && !checksum) // Keep-alive, just return
+            {
+                receive_start += 4;
+                return false;
+            }
+            else if(header == SOCKET_CLOSE && !checksum)
+            {
+                // We received a close request from the other socket, so close this socket as well.
+                receive_start += 4;
+                next_state = SocketState::Closing;
+                received_close = true;
+                return false;
+            }
+
+            int signature = (header & 0xffff0000) >> 16;
+            int major_version = (header & 0x0000ff00) >> 8;
+            int minor_version = header & 0x0000000f;
+            frame_flags = header & 0x000000f0;
+
+            if(signature != ARCUS_SIGNATURE)
+            {
+                // Someone might be speaking to us in a different protocol?
+                handleCorruptFrame("Header mismatch");
+                return false;
+            }
+
+            if(major_version != VERSION_MAJOR || minor_version != VERSION_MINOR)
+            {
+                handleCorruptFrame("Protocol version mismatch");
+                return false;
+            }
+
+            result = fillReceiveBuffer(offset + 12);
+            if(result != 1)
+            {
+                if(result == -1)
+                {
+                    error(ErrorCode::ReceiveFailedError, "Could not receive message header");
+                    current_message.reset();
+                }
+                return false;
+            }
+
+            std::memcpy(&size, &receive_buffer[receive_start + offset + 4], 4);
+            std::memcpy(&type, &receive_buffer[receive_start + offset + 8], 4);
+            size = ntohl(size);
+            type = ntohl(type);
+            header_size = 12;
+        }
+
+        if(checksum)
+        {
+            result = fillReceiveBuffer(offset + header_size + 4);
+            if(result != 1)
+            {
+                if(result == -1)
+                {
+                    error(ErrorCode::ReceiveFailedError, "Could not receive message header");
+                    current_message.reset();
+                }
+                return false;
+            }
+
+            uint32_t header_checksum = 0;
+            std::memcpy(&header_checksum, &receive_buffer[receive_start + offset + header_size], 4);
+            if(ntohl(header_checksum) != crc32c(&receive_buffer[receive_start + offset], header_size) || (frame_flags & FRAME_FLAG_CHECKSUM) == 0)
+            {
+                handleCorruptFrame("Header checksum mismatch");
+                return false;
+            }
+
+            header_size += 4;
+            receiving_checksums = true;
+        }
+        else if(frame_flags & FRAME_FLAG_CHECKSUM)
+        {
+            handleCorruptFrame("Header mismatch");
+            return false;
+        }
+
+        if((frame_flags & ~(FRAME_FLAG_CHUNKED | FRAME_FLAG_BATCH | FRAME_FLAG_CHECKSUM)) != 0)
+        {
+            handleCorruptFrame("Unsupported frame flags");
+            return false;
+        }
+
+        if(size > static_cast<uint32_t>(message_size_maximum))
+        {
+            current_message.reset();
+            fatalError(ErrorCode::ReceiveFailedError, "Message of size " + std::to_string(size) + " is larger than the maximum message size");
+            return false;
+        }
+
+        MemoryBudget& memory_budget = MemoryBudget::getInstance();
+        if(!memory_budget.fits(receive_memory, size))
+        {
+            current_message.reset();
+            fatalError(ErrorCode::ReceiveFailedError, "Message of size " + std::to_string(size) + " does not fit the receive memory limit");
+            return false;
+        }
+
+        if(!memory_budget.reserve(receive_memory, size, options.receive_timeout))
+        {
+            // Stop reading until queued messages have been taken. The header stays in the receive
+            // buffer, so it is handled again after sending queued messages.
+            return false;
+        }
+
+        receive_start += offset + header_size;
+
+        current_message->chunked = (frame_flags & FRAME_FLAG_CHUNKED) != 0;
+        current_message->batch = (frame_flags & FRAME_FLAG_BATCH) != 0;
+        current_message->checksum = checksum;
+        current_message->compact = compact;
+        current_message->size = size;
+        current_message->memory_account = &receive_memory;
+
+        // The type of a compact frame is an index in the table of types announced to the peer.
+        if(compact && !current_message->batch)
+        {
+            if(type < announced_types.size())
+            {
+                type = announced_types[type];
+            }
+            else
+            {
+                error(ErrorCode::UnknownMessageTypeError, "Unknown compact message type index");
+                current_message->valid = false;
+            }
+        }
+
+        try
+        {
+            current_message->allocateData();
+        }
+        catch (std::bad_alloc&)
+        {
+            // Either way we're in trouble.
+            current_message.reset();
+            fatalError(ErrorCode::ReceiveFailedError, "Out of memory");
+            return false;
+        }
+
+        DEBUG(std::string("Incoming message of type ") + std::to_string(type) + " and size " + std::to_string(size));
+        current_message->type = type;
+        current_message->state = WireMessage::MessageState::Data;
+        return true;
+    }
+
+    // Make sure at least size bytes of received data are available in the receive buffer.
+    //
+    // Returns 1 if the data is available, 0 if it has not been received yet, or -1 if an error occurred.
+    int Socket::Private::fillReceiveBuffer(std::size_t size)
+    {
+        while(receive_end - receive_start < size)
+        {
+            // Move the unprocessed data to the front to make room for more.
+            if(receive_start > 0)
+            {
+                std::memmove(receive_buffer.data(), receive_buffer.data() + receive_start, receive_end - receive_start);
+                receive_end -= receive_start;
+                receive_start = 0;
+            }
+
+            socket_size result = platform_socket.readBytes(receive_buffer.size() - receive_end, receive_buffer.data() + receive_end);
+            if(result < 0)
+            {
+                return -1;
+            }
+            else if(result == 0)
+            {
+                return 0;
+            }
+
+            receive_end += result;
+        }
+        return 1;
+    }
+
+    // Discard all data that has been received but not processed yet.
+    void Socket::Private::discardReceivedData()
+    {
+        receive_start = 0;
+        receive_end = 0;
+        platform_socket.flush();
+    }
+
+    // Recover from receiving a frame that is not valid.
+    //
+    // When the peer sends frames with checksums, received data is skipped up to the next sync marker,
+    // so only the corrupted frame is lost. Otherwise there is no way to find the start of the next
+    // frame, so all data that was received so far is discarded.
+    void Socket::Private::handleCorruptFrame(const std::string& message)
+    {
+        error(ErrorCode::ReceiveFailedError, message);
+        current_message.reset();
+
+        if(receiving_checksums)
+        {
+            // Skip the start of the corrupted frame, so it is not found as sync marker again.
+            if(receive_start < receive_end)
+            {
+                ++receive_start;
+            }
+            resynchronizing = true;
+        }
+        else
+        {
+            discardReceivedData();
+        }
+    }
+
+    // Process each of the messages contained in a batch frame.
+    void Socket::Private::handleBatch(const std::shared_ptr<WireMessage>& wire_message)
+    {
+        uint32_t offset = 0;
+        while(offset < wire_message->size)
+        {
+            uint32_t size = 0;
+            uint32_t type_id = 0;
+            if(wire_message->compact)
+            {
+                int size_length = readVarint(wire_message->data + offset, wire_message->size - offset, &size);
+                int type_length = size_length > 0 ? readVarint(wire_message->data + offset + size_length, wire_message->size - offset - size_length, &type_id) : -1;
+                if(type_length <= 0 || type_id >= announced_types.size())
+                {
+                    error(ErrorCode::ReceiveFailedError, "Batch frame invalid");
+                    return;
+                }
+                type_id = announced_types[type_id];
+                offset += size_length + type_length;
+            }
+            else
+            {
+                uint32_t entry_header[2] = { 0, 0 };
+                if(wire_message->size - offset < sizeof(entry_header))
+                {
+                    error(ErrorCode::ReceiveFailedError, "Batch frame invalid");
+                    return;
+                }
+
+                std::memcpy(entry_header, wire_message->data + offset, sizeof(entry_header));
+                size = ntohl(entry_header[0]);
+                type_id = ntohl(entry_header[1]);
+                offset += sizeof(entry_header);
+            }
+
+            if(size > wire_message->size - offset)
+            {
+                error(ErrorCode::ReceiveFailedError, "Batch frame invalid");
+                return;
+            }
+
+            handleMessage(type_id, wire_message->data + offset, size);
+            offset += size;
+        }
+    }
+
+    // Process the handshake of the peer, see sendHandshake().
+    void Socket::Private::handleHandshake(const char* data, uint32_t size)
+    {
+        std::vector<uint32_t> fields(size / 4);
+        std::memcpy(fields.data(), data, fields.size() * 4);
+        for(uint32_t& field : fields)
+        {
+            field = ntohl(field);
+        }
+
+        if(size % 4 != 0 || fields.size() < 3 || fields[2] > fields.size() - 3)
+        {
+            error(ErrorCode::ReceiveFailedError, "Handshake invalid");
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(write_mutex);
+            peer_version = fields[0];
+            peer_capabilities = fields[1];
+            peer_type_indices.clear();
+            for(uint32_t index = 0; index < fields[2]; ++index)
+            {
+                peer_type_indices[fields[index + 3]] = index;
+            }
+
+            DEBUG(std::string("Received handshake of version ") + std::to_string(peer_version) + " with " + std::to_string(fields[2]) + " message types");
+
+            // Peers only use compact frames after receiving our message types, so always answer.
+            if(!handshake_sent)
+            {
+                finishDirectWrite();
+                sendHandshake();
+            }
+        }
+
+        // The port of the datagram channel of the peer follows its message types.
+        if(datagram_channel && (peer_capabilities & CAPABILITY_DATAGRAM) != 0 && fields.size() > fields[2] + 3)
+        {
+            std::lock_guard<std::mutex> lock(datagram_mutex);
+            if(platform_socket.connectDatagramChannel(fields[fields[2] + 3]))
+            {
+                datagram_active = true;
+            }
+            else
+            {
+                error(ErrorCode::ConnectFailedError, "Could not connect datagram channel");
+            }
+        }
+    }
+
+    // Handle the datagrams waiting on the datagram channel.
+    void Socket::Private::receiveDatagrams()
+    {
+        char datagram[datagram_size_maximum];
+        socket_size size = 0;
+        while((size = platform_socket.readDatagram(sizeof(datagram), datagram)) > 0)
+        {
+            if(size < 4)
+            {
+                error(ErrorCode::ReceiveFailedError, "Datagram invalid");
+                continue;
+            }
+
+            // Datagrams may be lost anyway, so drop them instead of waiting when memory is short.
+            if(!MemoryBudget::getInstance().isAvailable(receive_memory, size - 4))
+            {
+                DEBUG("Dropped a datagram because the receive memory limit was reached");
+                continue;
+            }
+
+            uint32_t type_id = 0;
+            std::memcpy(&type_id, datagram, 4);
+            handleMessage(ntohl(type_id), datagram + 4, size - 4);
+        }
+    }
+
+    // Parse and process a message received on the socket.
+    void Socket::Private::handleMessage(uint32_t type_id, const char* data, uint32_t size)
+    {
+        if(!message_types.hasType(type_id))
+        {
+            DEBUG(std::string("Received message type: ") + std::to_string(type_id));
+            error(ErrorCode::UnknownMessageTypeError, "Unknown message type");
+            return;
+        }
+
+        MessagePtr message = message_types.createMessage(type_id);
+
+        google::protobuf::io::ArrayInputStream array(data, size);
+        google::protobuf::io::CodedInputStream stream(&array);
+        stream.SetTotalBytesLimit(message_size_maximum, message_size_warning);
+        if(!message->ParseFromCodedStream(&stream))
+        {
+            error(ErrorCode::ParseFailedError, "Failed to parse message:" + std::string(data, size));
+            return;
+        }
+
+        DEBUG(std::string("Received a message of type ") + std::to_string(type_id) + " and size " + std::to_string(size));
+
+        ++messages_received;
+        bytes_received += size;
+
+        if(message_handler)
+        {
+            dispatchMessage(type_id, message, size);
+            return;
+        }
+
+        auto type_queue = message_type_queues.find(type_id);
+        ReceiveQueue& queue = type_queue != message_type_queues.end() ? *type_queue->second : receive_queue;
+
+        queue.mutex.lock();
+        MemoryBudget::getInstance().add(receive_memory, size);
+        queue.messages.push_back(message);
+        queue.sizes.push_back(size);
+        queue.mutex.unlock();
+        queue.condition_variable.notify_one();
+
+        for(auto listener : ListenerSnapshot(*this))
+        {
+            listener->messageReceived();
+        }
+
+        // Sets only take messages from the default queue.
+        if(&queue == &receive_queue)
+        {
+            notifySocketSets(false);
+        }
+    }
+
+    // Pass a received message to the message handler, after the messages received earlier with the same key.
+    void Socket::Private::dispatchMessage(uint32_t type_id, const MessagePtr& message, uint32_t size)
+    {
+        uint64_t key = Strands::unkeyed;
+
+        auto key_field = message_key_fields.find(type_id);
+        if(key_field != message_key_fields.end())
+        {
+            const google::protobuf::FieldDescriptor* field = key_field->second;
+            const google::protobuf::Reflection* reflection = message->GetReflection();
+            switch(field->cpp_type())
+            {
+                case google::protobuf::FieldDescriptor::CPPTYPE_INT32:
+                    key = static_cast<uint64_t>(reflection->GetInt32(*message, field));
+                    break;
+                case google::protobuf::FieldDescriptor::CPPTYPE_INT64:
+                    key = static_cast<uint64_t>(reflection->GetInt64(*message, field));
+                    break;
+                case google::protobuf::FieldDescriptor::CPPTYPE_UINT32:
+                    key = reflection->GetUInt32(*message, field);
+                    break;
+                case google::protobuf::FieldDescriptor::CPPTYPE_UINT64:
+                    key = reflection->GetUInt64(*message, field);
+                    break;
+                case google::protobuf::FieldDescriptor::CPPTYPE_BOOL:
+                    key = reflection->GetBool(*message, field) ? 1 : 0;
+                    break;
+                case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
+                    key = static_cast<uint64_t>(reflection->GetEnumValue(*message, field));
+                    break;
+                case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
+                    key = std::hash<std::string>()(reflection->GetString(*message, field));
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // The message counts towards the receive memory until it has been handled. Keys that are
+        // equal by chance only make their messages wait for each other.
+        MemoryBudget::getInstance().add(receive_memory, size);
+        MessageHandler* handler = message_handler;
+        handler_strands.post(key, [this, handler, message, size]()
+        {
+            try
+            {
+                handler->handleMessage(socket, message);
+            }
+            catch(std::exception& e)
+            {
+                error(ErrorCode::UnknownError, std::string("Message handler failed: ") + e.what());
+            }
+            catch(...)
+            {
+                error(ErrorCode::UnknownError, "Message handler failed");
+            }
+            MemoryBudget::getInstance().release(receive_memory, size);
+        });
+    }
+
+    // Replace the listener list and delete the replaced list once no notification uses it. Called with listeners_mutex
+    // locked, which is released while waiting, so the listeners being notified can change the listeners as well.
+    //
+    // This waits for notifications in progress, so a removed listener is not called anymore once this returns. A notification
+    // of this socket cannot wait for itself, so then the replaced list is deleted when the listeners change again.
+    void Socket::Private::replaceListeners(const ListenerList* list, std::unique_lock<std::mutex>& lock)
+    {
+        uint64_t replacement = ++listener_replacements;
+        retired_listeners.emplace_back(replacement, listeners.exchange(list));
+        lock.unlock();
+
+        if(isNotifying())
+        {
+            return;
+        }
+
+        // Notifications that start from now on use the new list, so once no notification is in progress,
+        // none uses a list replaced up to now. Lists replaced meanwhile are left to the replacement that did so.
+        while(listener_readers > 0)
+        {
+            std::this_thread::yield();
+        }
+
+        lock.lock();
+        auto retired = retired_listeners.begin();
+        for(; retired != retired_listeners.end() && retired->first <= replacement; ++retired)
+        {
+            delete retired->second;
+        }
+        retired_listeners.erase(retired_listeners.begin(), retired);
+    }
+
+    // Whether the current thread is notifying the listeners of this socket.
+    bool Socket::Private::isNotifying() const
+    {
+        auto& sockets = getNotifyingSockets();
+        return std::find(sockets.begin(), sockets.end(), this) != sockets.end();
+    }
+
+    // The sockets whose listeners the current thread is notifying, innermost last.
+    std::vector<const Socket::Private*>& Socket::Private::getNotifyingSockets()
+    {
+        thread_local std::vector<const Private*> sockets;
+        return sockets;
+    }
+
+    // Take the next message of a receive queue, waiting until there is one. Returns an invalid pointer once the socket has closed.
+    MessagePtr Socket::Private::takeReceivedMessage(ReceiveQueue& queue)
+    {
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        queue.condition_variable.wait(lock, [&]()
+        {
+            return !queue.messages.empty() || state == SocketState::Closed || state == SocketState::Error;
+        });
+
+        if(queue.messages.empty())
+        {
+            return MessagePtr();
+        }
+
+        return popReceivedMessage(queue);
+    }
+
+    // Take the first message of a receive queue and return the memory used by it. Called with the mutex of the queue locked.
+    MessagePtr Socket::Private::popReceivedMessage(ReceiveQueue& queue)
+    {
+        MessagePtr next = queue.messages.front();
+        queue.messages.pop_front();
+
+        MemoryBudget::getInstance().release(receive_memory, queue.sizes.front());
+        queue.sizes.pop_front();
+        return next;
+    }
+
+    // Wake up the threads waiting for messages, so they notice the socket has closed.
+    void Socket::Private::notifyReceiveQueues()
+    {
+        // Locking makes sure a thread that is about to wait sees the new state or gets woken up.
+        {
+            std::lock_guard<std::mutex> lock(receive_queue.mutex);
+        }
+        receive_queue.condition_variable.notify_all();
+
+        for(const auto& named_queue : named_receive_queues)
+        {
+            {
+                std::lock_guard<std::mutex> lock(named_queue.second->mutex);
+            }
+            named_queue.second->condition_variable.notify_all();
+        }
+    }
+
+    // Parse and queue any elements of streamed fields that have been completely received.
+    void Socket::Private::handleStreamedFields(const std::shared_ptr<WireMessage>& wire_message)
+    {
+        auto fields = streamed_fields.find(wire_message->type);
+        if(fields == streamed_fields.end())
+        {
+            return;
+        }
+
+        bool received_elements = false;
+        while(wire_message->scanned_size < wire_message->received_size)
+        {
+            const uint8_t* start = reinterpret_cast<const uint8_t*>(wire_message->data) + wire_message->scanned_size;
+            const int available = wire_message->received_size - wire_message->scanned_size;
+            google::protobuf::io::CodedInputStream stream(start, available);
+
+            // Any read that fails here means the field has not been completely received yet.
+            uint32_t tag = stream.ReadTag();
+            if(tag == 0)
+            {
+                break;
+            }
+
+            bool complete = true;
+            uint64_t length = 0;
+            switch(tag & 0x7) // The lower three bits of a tag contain the wire type of the field.
+            {
+                case 0: // Varint
+                    complete = stream.ReadVarint64(&length);
+                    length = 0;
+                    break;
+                case 1: // 64-bit
+                    length = 8;
+                    break;
+                case 2: // Length-delimited
+                    complete = stream.ReadVarint64(&length);
+                    break;
+                case 5: // 32-bit
+                    length = 4;
+                    break;
+                default:
+                    // Groups are deprecated and cannot be skipped without parsing them, so stop scanning this message.
+                    wire_message->scanned_size = wire_message->size;
+                    return;
+            }
+
+            const uint64_t field_start = stream.CurrentPosition();
+            if(!complete || field_start + length > static_cast<uint64_t>(available))
+            {
+                break;
+            }
+
+            auto prototype = fields->second.find(tag >> 3);
+            if((tag & 0x7) == 2 && prototype != fields->second.end())
+            {
+                MessagePtr element(prototype->second->New());
+                if(element->ParseFromArray(start + field_start, static_cast<int>(length)))
+                {
+                    if(wire_message->stream_sequence == 0)
+                    {
+                        wire_message->stream_sequence = ++streamed_messages;
+                    }
+
+                    streamedQueueMutex.lock();
+                    streamedQueue.push_back(StreamedElement{element, wire_message->type, static_cast<int>(tag >> 3), wire_message->stream_sequence});
+                    streamedQueueMutex.unlock();
+                    received_elements = true;
+                }
+                else
+                {
+                    error(ErrorCode::ParseFailedError, "Failed to parse streamed element of " + prototype->second->GetTypeName());
+                }
+            }
+
+            wire_message->scanned_size += static_cast<uint32_t>(field_start + length);
+        }
+
+        if(received_elements)
+        {
+            for(auto listener : ListenerSnapshot(*this))
+            {
+                listener->streamedMessageReceived();
+            }
+        }
+    }
+
+    // Send a keepalive packet to check whether we are still connected.
+    void Socket::Private::checkConnectionState()
+    {
+        auto now = std::chrono::system_clock::now();
+        auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_keep_alive_sent);
+
+        if(diff.count() > keep_alive_rate)
+        {
+            // The compact keepalive is a single byte.
+            const char compact_keepalive = static_cast<char>(V2_KEEPALIVE);
             int32_t keepalive = 0;
-            if(platform_socket.writeUInt32(keepalive) == -1)
+            std::lock_guard<std::mutex> lock(write_mutex);
+            bool sent = finishDirectWrite() && (useCompactFrames() ? writeData(&compact_keepalive, 1) : platform_socket.writeUInt32(keepalive) != -1);
+            if(!sent)
             {
                 error(ErrorCode::ConnectionResetError, "Connection reset by peer");
                 next_state = SocketState::Closing;
@@ -586,4 +2436,17 @@ namespace Arcus
             last_keep_alive_sent = now;
         }
     }
+
+    // Let the sets this socket is in know that there is an event to report. Received messages are not reported to sets that only follow state changes.
+    void Socket::Private::notifySocketSets(bool state_changed)
+    {
+        std::lock_guard<std::mutex> lock(socket_sets_mutex);
+        for(const auto& socket_set : socket_sets)
+        {
+            if(state_changed || !socket_set->only_state_changes)
+            {
+                socket_set->notify(socket);
+            }
+        }
+    }
 }
@@ -0,0 +1,94 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Strands_p.h"
+#include "Executor_p.h"
+
+using namespace Arcus::Private;
+
+Strands::Strands()
+    : pending(0)
+{
+}
+
+Strands::~Strands()
+{
+    waitForIdle();
+}
+
+void Strands::post(uint64_t key, std::function<void()> task)
+{
+    bool schedule = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& tasks = strands[key];
+        schedule = tasks.empty();
+        tasks.push_back(std::move(task));
+        ++pending;
+    }
+
+    // Only one thread runs the tasks of a key at a time, the one that is already running them picks this up.
+    if(schedule)
+    {
+        Executor::getInstance().post([this, key]() { run(key); });
+    }
+}
+
+void Strands::waitForIdle()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle_condition_variable.wait(lock, [this]() { return pending == 0; });
+}
+
+void Strands::run(uint64_t key)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for(int i = 0; i < tasks_per_turn; ++i)
+    {
+        // The task stays in the queue while it runs, so tasks posted meanwhile do not schedule the key again.
+        std::function<void()> task = std::move(strands[key].front());
+        lock.unlock();
+        try
+        {
+            task();
+        }
+        catch(...)
+        {
+            // Tasks report their own errors. Ignore anything else, so the strand keeps running its other tasks.
+        }
+        lock.lock();
+
+        auto& tasks = strands[key];
+        tasks.pop_front();
+        --pending;
+
+        if(tasks.empty())
+        {
+            strands.erase(key);
+            if(pending == 0)
+            {
+                idle_condition_variable.notify_all();
+            }
+            return;
+        }
+    }
+
+    // Give other keys a turn before running the rest.
+    lock.unlock();
+    Executor::getInstance().post([this, key]() { run(key); });
+}
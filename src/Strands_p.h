@@ -0,0 +1,76 @@
+/*
+ * This file is part of libArcus
+ *
+ * Copyright (C) 2016 Ultimaker b.v. <a.hiemstra@ultimaker.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License v3.0 as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License v3.0 for more details.
+ * You should have received a copy of the GNU Lesser General Public License v3.0
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCUS_STRANDS_P_H
+#define ARCUS_STRANDS_P_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+namespace Arcus
+{
+    namespace Private
+    {
+        /**
+         * Private class that runs tasks on the executor, ordered per key.
+         *
+         * Tasks posted with the same key run one after the other in the order they were posted.
+         * Tasks with different keys can run at the same time.
+         */
+        class Strands
+        {
+        public:
+            Strands();
+            ~Strands();
+
+            /**
+             * Run a task after the tasks posted earlier with the same key.
+             */
+            void post(uint64_t key, std::function<void()> task);
+
+            /**
+             * Wait until all posted tasks have run.
+             */
+            void waitForIdle();
+
+            // Key of the tasks that are not ordered by any key, which run in the order they were posted.
+            static const uint64_t unkeyed = UINT64_MAX;
+
+        private:
+            // Run the tasks of a key that are waiting, then hand the thread back to the executor.
+            void run(uint64_t key);
+
+            // Tasks that have been posted and not run yet, by key. A key is present while its tasks are being run.
+            std::unordered_map<uint64_t, std::deque<std::function<void()>>> strands;
+            // Amount of tasks that have been posted and not finished.
+            std::size_t pending;
+
+            std::mutex mutex;
+            std::condition_variable idle_condition_variable;
+
+            // Maximum amount of tasks of one key that run before other keys get a turn.
+            static const int tasks_per_turn = 16;
+        };
+    }
+}
+
+#endif //ARCUS_STRANDS_P_H
@@ -55,6 +55,124 @@ namespace Arcus
             Error ///< A fatal error happened that blocks the socket from operating.
         };
     }
+
+    /**
+     * Priority class of a message that is sent.
+     *
+     * Queued messages of a higher priority are always sent before those of a lower priority.
+     */
+    namespace MessagePriority
+    {
+        // Note: Not using enum class due to incompatibility with SIP.
+        enum MessagePriority
+        {
+            High, ///< Control messages that should overtake any other traffic.
+            Normal, ///< The default priority.
+            Low ///< Bulk data that can wait for everything else.
+        };
+    }
+
+    /**
+     * Status of a message passed to Socket::sendMessage().
+     */
+    namespace SendStatus
+    {
+        // Note: Not using enum class due to incompatibility with SIP.
+        enum SendStatus
+        {
+            Queued, ///< Waiting in the send queue.
+            Sending, ///< Being written to the socket.
+            Sent, ///< Completely written to the socket.
+            Cancelled, ///< Cancelled before it was completely sent.
+            Expired, ///< Dropped because its deadline passed before it could be sent.
+            Failed, ///< Could not be sent.
+            Dropped ///< Dropped because the datagram channel had no room for it.
+        };
+    }
+
+    /**
+     * How a SocketPool chooses the socket to send a message with.
+     */
+    namespace RoutingPolicy
+    {
+        // Note: Not using enum class due to incompatibility with SIP.
+        enum RoutingPolicy
+        {
+            LeastBytes, ///< The socket with the least data waiting to be sent.
+            LeastQueued, ///< The socket with the least messages waiting to be sent.
+            ConsistentHash ///< The socket the key of the message maps to, so equal keys use the same socket.
+        };
+    }
+
+    /**
+     * Counters describing the traffic handled by a socket since it was created.
+     */
+    struct SocketStatistics
+    {
+        SocketStatistics()
+            : messages_sent(0)
+            , messages_received(0)
+            , messages_cancelled(0)
+            , messages_expired(0)
+            , messages_dropped(0)
+            , bytes_sent(0)
+            , bytes_received(0)
+        {
+        }
+
+        uint64_t messages_sent; ///< Messages completely sent.
+        uint64_t messages_received; ///< Messages received and parsed.
+        uint64_t messages_cancelled; ///< Messages cancelled before they were completely sent.
+        uint64_t messages_expired; ///< Messages dropped from the send queue because their deadline passed.
+        uint64_t messages_dropped; ///< Datagrams dropped because the datagram channel had no room for them.
+        uint64_t bytes_sent; ///< Serialized message data sent, excluding framing.
+        uint64_t bytes_received; ///< Serialized message data received, excluding framing.
+    };
+
+    /**
+     * Options of the underlying network connection and the thread handling it, see Socket::setOptions().
+     *
+     * Options that are not supported by the platform are ignored.
+     */
+    struct SocketOptions
+    {
+        SocketOptions()
+            : no_delay(false)
+            , send_buffer_size(0)
+            , receive_buffer_size(0)
+            , cork(false)
+            , busy_poll(0)
+            , quick_ack(false)
+            , receive_timeout(250)
+            , spin_time(0)
+            , thread_name("Arcus")
+            , thread_cpu(-1)
+            , thread_priority(0)
+            , reuse_port(false)
+            , send_rate(0)
+            , send_burst(0)
+            , send_weight(1)
+            , receive_memory_limit(0)
+        {
+        }
+
+        bool no_delay; ///< Send small messages immediately instead of waiting to fill a packet (TCP_NODELAY).
+        int send_buffer_size; ///< Size of the send buffer in bytes, or 0 for the system default (SO_SNDBUF).
+        int receive_buffer_size; ///< Size of the receive buffer in bytes, or 0 for the system default (SO_RCVBUF).
+        bool cork; ///< Hold back partial packets while writing several queued messages, then send them together (TCP_CORK).
+        int busy_poll; ///< Time in microseconds to busy poll for data when receiving, or 0 to disable (SO_BUSY_POLL).
+        bool quick_ack; ///< Acknowledge received data immediately instead of delaying acknowledgements (TCP_QUICKACK).
+        int receive_timeout; ///< Maximum time in milliseconds to wait for data before handling sending again.
+        int spin_time; ///< Time in microseconds to keep checking for data before waiting for it, or 0 to always wait.
+        std::string thread_name; ///< Name of the thread handling the connection.
+        int thread_cpu; ///< Index of the processor to run the thread handling the connection on, or -1 for any.
+        int thread_priority; ///< Real-time priority from 1 to 99 of the thread handling the connection, or 0 for the default.
+        bool reuse_port; ///< Let several sockets listen on the same port, spreading connections across them (SO_REUSEPORT). A listening socket closes after accepting one connection, which resets the connections still waiting in its backlog.
+        uint64_t send_rate; ///< Maximum rate in bytes per second to send data at, or 0 for no limit.
+        uint32_t send_burst; ///< Amount of bytes that can be sent at once after not sending for a while, or 0 for 64 KiB.
+        int send_weight; ///< Share of the total send rate of the process this socket gets when others are sending too, see Socket::setTotalSendRate().
+        uint64_t receive_memory_limit; ///< Maximum memory in bytes used by messages being received and waiting to be taken, or 0 for no limit.
+    };
 }
 
 #endif //ARCUS_TYPES_H
@@ -19,6 +19,9 @@
 #ifndef ARCUS_WIRE_MESSAGE_P_H
 #define ARCUS_WIRE_MESSAGE_P_H
 
+#include <chrono>
+
+#include "MemoryBudget_p.h"
 #include "Types.h"
 
 namespace Arcus
@@ -36,10 +39,9 @@ namespace Arcus
              */
             enum class MessageState
             {
-                Header, ///< Check for the header.
-                Size, ///< Check for the message size.
-                Type, ///< Check for the message type.
+                Header, ///< Check for the header, containing the message size and type.
                 Data, ///< Get the message data.
+                Checksum, ///< Check the checksum of the message data.
                 Dispatch ///< Process the message and parse it into a protobuf message.
             };
 
@@ -47,9 +49,18 @@ namespace Arcus
                 : state(MessageState::Header)
                 , size(0)
                 , received_size(0)
+                , scanned_size(0)
+                , stream_sequence(0)
+                , chunked(false)
+                , chunk_remaining(0)
+                , batch(false)
+                , compact(false)
+                , checksum(false)
+                , data_checksum(0)
                 , valid(true)
                 , type(0)
                 , data(nullptr)
+                , memory_account(nullptr)
             {
             }
 
@@ -59,6 +70,11 @@ namespace Arcus
                 {
                     delete[] data;
                 }
+
+                if(memory_account)
+                {
+                    MemoryBudget::getInstance().release(*memory_account, size);
+                }
             }
 
             // Current message state.
@@ -67,12 +83,32 @@ namespace Arcus
             uint32_t size;
             // Amount of bytes received so far.
             uint32_t received_size;
+            // Amount of received bytes that have been scanned for streamed fields.
+            uint32_t scanned_size;
+            // Sequence number shared by the streamed elements of this message, or 0 if none were received yet.
+            uint64_t stream_sequence;
+            // Is the data of this message sent in chunks?
+            bool chunked;
+            // Amount of bytes remaining in the current chunk.
+            uint32_t chunk_remaining;
+            // Does the data of this message contain a batch of messages?
+            bool batch;
+            // Was this message received in a compact frame?
+            bool compact;
+            // Is the data of this message followed by its checksum?
+            bool checksum;
+            // Checksum of the data received so far.
+            uint32_t data_checksum;
             // Is this a potentially valid message?
             bool valid;
             // The type of message.
             uint32_t type;
             // The data of the message.
             char* data;
+            // The account the memory for the data of this message was reserved from, if any.
+            MemoryBudget::Account* memory_account;
+            // When progress of receiving this message was last reported.
+            std::chrono::steady_clock::time_point last_progress;
 
             // Return how many bytes are remaining for this message to be complete.
             inline uint32_t getRemainingSize() const